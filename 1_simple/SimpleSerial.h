@@ -9,7 +9,12 @@
 #ifndef _SIMPLESERIAL_H
 #define	_SIMPLESERIAL_H
 
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
 #include <boost/asio.hpp>
+#include <boost/utility/string_view.hpp>
 
 class SimpleSerial
 {
@@ -22,7 +27,7 @@ public:
      * serial device
      */
     SimpleSerial(std::string port, unsigned int baud_rate)
-    : io(), serial(io,port)
+    : io(), serial(io,port), readBegin(0), readEnd(0)
     {
         serial.set_option(boost::asio::serial_port_base::baud_rate(baud_rate));
     }
@@ -32,9 +37,9 @@ public:
      * \param s string to write
      * \throws boost::system::system_error on failure
      */
-    void writeString(std::string s)
+    void writeString(boost::string_view s)
     {
-        boost::asio::write(serial,boost::asio::buffer(s.c_str(),s.size()));
+        boost::asio::write(serial,boost::asio::buffer(s.data(),s.size()));
     }
 
     /**
@@ -45,28 +50,104 @@ public:
      */
     std::string readLine()
     {
-        //Reading data char by char, code is optimized for simplicity, not speed
-        using namespace boost;
-        char c;
         std::string result;
+        readLine(result);
+        return result;
+    }
+
+    /**
+     * Blocks until a line is received from the serial device.
+     * Same as readLine(), but the line is stored in a caller provided
+     * string, whose capacity is reused across calls so that no memory
+     * allocation takes place once it has grown to the longest line.
+     * \param line string where the received line is stored
+     * \return a view of line
+     * \throws boost::system::system_error on failure
+     */
+    boost::string_view readLine(std::string& line)
+    {
+        //Data is read in chunks into readBuffer, and lines are split out of
+        //it with memchr. Bytes past the '\n' are kept for the next call
+        line.clear();
+        for(;;)
+        {
+            fillReadBuffer();
+            const char *begin=readBuffer+readBegin;
+            const char *end=readBuffer+readEnd;
+            const char *nl=static_cast<const char*>(
+                    std::memchr(begin,'\n',end-begin));
+            if(nl==0)
+            {
+                line.append(begin,end);
+                readBegin=readEnd;
+                continue;
+            }
+            line.append(begin,nl);
+            readBegin+=nl-begin+1;
+            line.erase(std::remove(line.begin(),line.end(),'\r'),line.end());
+            return boost::string_view(line);
+        }
+    }
+
+    /**
+     * Blocks until a line is received from the serial device.
+     * Same as readLine(), but the line is stored in a caller provided
+     * buffer, so no memory allocation takes place.
+     * \param data buffer where the received line is stored
+     * \param size buffer size
+     * \return a view of the line stored in data
+     * \throws boost::system::system_error on failure
+     * \throws std::length_error if the line does not fit in the buffer. In
+     * this case the whole line is discarded, and the next call will return
+     * the following line
+     */
+    boost::string_view readLine(char *data, size_t size)
+    {
+        size_t len=0;
+        bool overflow=false;
         for(;;)
         {
-            asio::read(serial,asio::buffer(&c,1));
-            switch(c)
+            fillReadBuffer();
+            const char *begin=readBuffer+readBegin;
+            const char *end=readBuffer+readEnd;
+            const char *nl=static_cast<const char*>(
+                    std::memchr(begin,'\n',end-begin));
+            const char *last= nl==0 ? end : nl;
+            for(const char *it=begin;it!=last;++it)
             {
-                case '\r':
-                    break;
-                case '\n':
-                    return result;
-                default:
-                    result+=c;
+                if(*it=='\r') continue;
+                if(len<size) data[len++]=*it;
+                else overflow=true;
             }
+            readBegin+=last-begin;
+            if(nl==0) continue;
+            readBegin++; //Skip '\n'
+            if(overflow) throw std::length_error("Line too long");
+            return boost::string_view(data,len);
         }
     }
+    /**
+     * Read buffer size
+     */
+    static const size_t readBufferSize=512;
 
 private:
+    /**
+     * If readBuffer has been fully consumed, blocks until some more data
+     * is received from the serial device.
+     */
+    void fillReadBuffer()
+    {
+        if(readBegin!=readEnd) return;
+        readBegin=0;
+        readEnd=serial.read_some(boost::asio::buffer(readBuffer,readBufferSize));
+    }
+
     boost::asio::io_service io;
     boost::asio::serial_port serial;
+    char readBuffer[readBufferSize]; ///< Data read but not yet consumed
+    size_t readBegin; ///< First unconsumed byte in readBuffer
+    size_t readEnd; ///< One past the last valid byte in readBuffer
 };
 
 #endif	/* _SIMPLESERIAL_H */
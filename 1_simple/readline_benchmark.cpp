@@ -0,0 +1,71 @@
+/*
+ * Memory allocation benchmark for SimpleSerial::readLine().
+ * The other end of the port is a pseudo terminal written by this program
+ * with 40 byte lines, that counts the heap allocations made while reading
+ * them with each readLine() overload. Linux only, as it uses a pseudo
+ * terminal.
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#include "SimpleSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static atomic<size_t> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1,memory_order_relaxed);
+    if(void *p=malloc(size)) return p;
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+static const int lines=1000;
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        SimpleSerial serial(pty.name(),115200);
+        string data;
+        for(int i=0;i<lines;i++) data+=string(39,'a'+i%26)+"\n"; //40 bytes
+        cout<<"overload\t\t\tallocations/line"<<endl;
+        for(int overload=0;overload<3;overload++)
+        {
+            thread writer([&pty,&data]{ pty.write(data); });
+            string line;
+            char buffer[64];
+            size_t before=allocations;
+            for(int i=0;i<lines;i++)
+            {
+                switch(overload)
+                {
+                    case 0: serial.readLine(); break;
+                    case 1: serial.readLine(line); break;
+                    case 2: serial.readLine(buffer,sizeof(buffer)); break;
+                }
+            }
+            size_t count=allocations-before;
+            writer.join();
+            const char *names[]={"readLine()\t\t","readLine(string&)\t",
+                "readLine(char*,size_t)"};
+            cout<<names[overload]<<"\t"<<double(count)/lines<<endl;
+        }
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+}
@@ -4,6 +4,27 @@
  * Distributed under the Boost Software License, Version 1.0.
  * Created on September 12, 2009, 3:47 PM
  *
+ * v1.16: Any integer baud rate on Linux, added getBaudRate()
+ *
+ * v1.15: Added busy polling
+ *
+ * v1.14: Added scatter read
+ *
+ * v1.13: Added readAtLeast() and readSome()
+ *
+ * v1.12: Added reading gap delimited frames
+ *
+ * v1.11: Added pipelined transactions
+ *
+ * v1.10: The timeout now applies also to writes, added writeSome()
+ *
+ * v1.09: Added reading until any of a set of delimiters or a match condition
+ *
+ * v1.08: Added overloads reading into caller provided storage, the internal
+ * read buffer is now bounded.
+ *
+ * v1.07: Added a poll() based backend for Linux
+ *
  * v1.06: C++11 support
  *
  * v1.05: Fixed a bug regarding reading after a timeout (again).
@@ -21,22 +42,196 @@
 
 #include "TimeoutSerial.h"
 #include <string>
+#include <cstring>
 #include <algorithm>
 #include <iostream>
+#include <utility>
 #include <boost/bind.hpp>
 
+#ifdef TIMEOUTSERIAL_POLL
+#ifndef __linux__
+#error "TIMEOUTSERIAL_POLL is only supported on Linux"
+#endif //__linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif //TIMEOUTSERIAL_POLL
+
+#ifdef __linux__
+#include "termios2.h"
+#endif //__linux__
+
 using namespace std;
 using namespace boost;
 
-TimeoutSerial::TimeoutSerial(): io(), port(io), timer(io),
-        timeout(boost::posix_time::seconds(0)) {}
+//
+// Handler allocation
+//
+
+template<typename T>
+class TimeoutSerial::HandlerAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit HandlerAllocator(HandlerMemory& memory) : memory(&memory) {}
+
+    template<typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) : memory(other.memory) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T*>(memory->allocate(sizeof(T)*n));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        memory->deallocate(p);
+    }
+
+    template<typename U>
+    bool operator==(const HandlerAllocator<U>& other) const
+    {
+        return memory==other.memory;
+    }
+
+    template<typename U>
+    bool operator!=(const HandlerAllocator<U>& other) const
+    {
+        return memory!=other.memory;
+    }
+
+    HandlerMemory *memory;
+};
+
+template<typename Handler>
+class TimeoutSerial::AllocHandler
+{
+public:
+    typedef HandlerAllocator<Handler> allocator_type;
+
+    AllocHandler(HandlerMemory& memory, const Handler& handler)
+            : memory(memory), handler(handler) {}
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type(memory);
+    }
+
+    template<typename... Args>
+    void operator()(Args&&... args)
+    {
+        handler(std::forward<Args>(args)...);
+    }
+
+private:
+    HandlerMemory& memory;
+    Handler handler;
+};
+
+template<typename Handler>
+TimeoutSerial::AllocHandler<Handler> TimeoutSerial::makeAllocHandler(
+        HandlerMemory& memory, const Handler& handler)
+{
+    return AllocHandler<Handler>(memory,handler);
+}
+
+/**
+ * Buffer sequence referencing an array of asio::mutable_buffer, so that it
+ * can be passed to asio without copying the array
+ */
+class BufferRange
+{
+public:
+    typedef asio::mutable_buffer value_type;
+    typedef const asio::mutable_buffer *const_iterator;
+
+    BufferRange(const_iterator first, const_iterator last)
+            : first(first), last(last) {}
+
+    const_iterator begin() const { return first; }
+    const_iterator end() const { return last; }
+
+private:
+    const_iterator first, last;
+};
+
+/**
+ * Adapts a TimeoutSerial::MatchCondition to the match condition interface
+ * of asio::async_read_until, relying on asio::streambuf being contiguous
+ */
+class MatchConditionAdapter
+{
+public:
+    typedef asio::buffers_iterator<asio::streambuf::const_buffers_type>
+            iterator;
+    typedef pair<iterator,bool> result_type;
+
+    explicit MatchConditionAdapter(const TimeoutSerial::MatchCondition& match)
+            : match(&match) {}
+
+    result_type operator()(iterator begin, iterator end) const
+    {
+        if(begin==end) return make_pair(begin,false);
+        const char *b=&*begin;
+        pair<const char*,bool> found=(*match)(b,b+(end-begin));
+        return make_pair(begin+(found.first-b),found.second);
+    }
+
+private:
+    const TimeoutSerial::MatchCondition *match;
+};
+
+TimeoutSerial::HandlerMemory::HandlerMemory()
+{
+    for(int i=0;i<numSlots;i++) inUse[i]=false;
+}
+
+void *TimeoutSerial::HandlerMemory::allocate(size_t size)
+{
+    if(size<=slotSize)
+    {
+        for(int i=0;i<numSlots;i++)
+        {
+            if(inUse[i]) continue;
+            inUse[i]=true;
+            return &slots[i];
+        }
+    }
+    return ::operator new(size);//Slots too small or all in use
+}
+
+void TimeoutSerial::HandlerMemory::deallocate(void *p)
+{
+    for(int i=0;i<numSlots;i++)
+    {
+        if(p!=&slots[i]) continue;
+        inUse[i]=false;
+        return;
+    }
+    ::operator delete(p);
+}
+
+//
+// Class TimeoutSerial
+//
+
+TimeoutSerial::TimeoutSerial(): io(), port(io), timer(io), gapTimer(io),
+        timerGeneration(0), timeout(boost::posix_time::seconds(0)),
+        busyPoll(chrono::steady_clock::duration::zero()), baudRate(0),
+        readData(readBufferMaxSize), transferInProgress(false) {}
 
 TimeoutSerial::TimeoutSerial(const std::string& devname, unsigned int baud_rate,
         asio::serial_port_base::parity opt_parity,
         asio::serial_port_base::character_size opt_csize,
         asio::serial_port_base::flow_control opt_flow,
         asio::serial_port_base::stop_bits opt_stop)
-        : io(), port(io), timer(io), timeout(boost::posix_time::seconds(0))
+        : io(), port(io), timer(io), gapTimer(io),
+        timerGeneration(0), timeout(boost::posix_time::seconds(0)),
+        busyPoll(chrono::steady_clock::duration::zero()), baudRate(0),
+        readData(readBufferMaxSize), transferInProgress(false)
 {
     open(devname,baud_rate,opt_parity,opt_csize,opt_flow,opt_stop);
 }
@@ -49,11 +244,35 @@ void TimeoutSerial::open(const std::string& devname, unsigned int baud_rate,
 {
     if(isOpen()) close();
     port.open(devname);
-    port.set_option(asio::serial_port_base::baud_rate(baud_rate));
     port.set_option(opt_parity);
     port.set_option(opt_csize);
     port.set_option(opt_flow);
     port.set_option(opt_stop);
+    //Last, as asio only knows the baud rates having a B* constant
+    #ifdef HAVE_TERMIOS2
+    boost::system::error_code ec;
+    baudRate=setBaudRate(port.native_handle(),baud_rate,ec);
+    if(ec)
+    {
+        port.close();
+        throw(boost::system::system_error(ec,"Can't set baud rate"));
+    }
+    #else //HAVE_TERMIOS2
+    port.set_option(asio::serial_port_base::baud_rate(baud_rate));
+    asio::serial_port_base::baud_rate applied;
+    port.get_option(applied);
+    baudRate=applied.value();
+    #endif //HAVE_TERMIOS2
+
+    #ifdef TIMEOUTSERIAL_POLL
+    int flags=fcntl(port.native_handle(),F_GETFL,0);
+    if(flags<0 || fcntl(port.native_handle(),F_SETFL,flags | O_NONBLOCK)<0)
+    {
+        boost::system::error_code ec(errno,boost::system::system_category());
+        port.close();
+        throw(boost::system::system_error(ec,"Can't set non blocking mode"));
+    }
+    #endif //TIMEOUTSERIAL_POLL
 }
 
 bool TimeoutSerial::isOpen() const
@@ -61,6 +280,11 @@ bool TimeoutSerial::isOpen() const
     return port.is_open();
 }
 
+unsigned int TimeoutSerial::getBaudRate() const
+{
+    return baudRate;
+}
+
 void TimeoutSerial::close()
 {
     if(isOpen()==false) return;
@@ -72,49 +296,90 @@ void TimeoutSerial::setTimeout(const boost::posix_time::time_duration& t)
     timeout=t;
 }
 
+void TimeoutSerial::setBusyPoll(const boost::posix_time::time_duration& t)
+{
+    if(t.is_pos_infinity())
+    {
+        busyPoll=chrono::steady_clock::duration::max();
+        return;
+    }
+    if(t.is_special() || t.is_negative())
+        throw(std::invalid_argument("Invalid busy polling time"));
+    busyPoll=chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::microseconds(t.total_microseconds()));
+}
+
 void TimeoutSerial::write(const char *data, size_t size)
 {
-    asio::write(port,asio::buffer(data,size));
+    if(writeSome(data,size)<size) throw(timeout_exception("Timeout expired"));
 }
 
 void TimeoutSerial::write(const std::vector<char>& data)
 {
-    asio::write(port,asio::buffer(&data[0],data.size()));
+    write(data.data(),data.size());
 }
 
 void TimeoutSerial::writeString(const std::string& s)
 {
-    asio::write(port,asio::buffer(s.c_str(),s.size()));
+    write(s.data(),s.size());
+}
+
+size_t TimeoutSerial::writeSome(const char *data, size_t size)
+{
+    #ifdef TIMEOUTSERIAL_POLL
+    chrono::steady_clock::time_point deadline=pollDeadline();
+    size_t written=0;
+    while(written<size)
+    {
+        size_t n=pollWrite(data+written,size-written,deadline);
+        if(n==0) break; //Timeout
+        written+=n;
+    }
+    return written;
+    #else //TIMEOUTSERIAL_POLL
+    result=resultInProgress;
+    bytesTransferred=0;
+    transferInProgress=true;
+    asio::async_write(port,asio::buffer(data,size),
+            makeAllocHandler(handlerMemory,boost::bind(
+            &TimeoutSerial::transferCompleted,this,asio::placeholders::error,
+            asio::placeholders::bytes_transferred)));
+    startTimer();
+    return waitTransfer("Error while writing");
+    #endif //TIMEOUTSERIAL_POLL
 }
 
 void TimeoutSerial::read(char *data, size_t size)
 {
     if(readData.size()>0)//If there is some data from a previous read
     {
-        istream is(&readData);
         size_t toRead=min(readData.size(),size);//How many bytes to read?
-        is.read(data,toRead);
+        memcpy(data,readData.data().data(),toRead);
+        readData.consume(toRead);
         data+=toRead;
         size-=toRead;
         if(size==0) return;//If read data was enough, just return
     }
-    
+
+    #ifdef TIMEOUTSERIAL_POLL
+    chrono::steady_clock::time_point deadline=pollDeadline();
+    while(size>0)
+    {
+        size_t n=pollRead(data,size,deadline);
+        if(n==0) throw(timeout_exception("Timeout expired"));
+        data+=n;
+        size-=n;
+    }
+    #else //TIMEOUTSERIAL_POLL
     setupParameters=ReadSetupParameters(data,size);
     performReadSetup(setupParameters);
+    startTimer();
 
-    //For this code to work, there should always be a timeout, so the
-    //request for no timeout is translated into a very long timeout
-    if(timeout!=boost::posix_time::seconds(0)) timer.expires_from_now(timeout);
-    else timer.expires_from_now(boost::posix_time::hours(100000));
-    
-    timer.async_wait(boost::bind(&TimeoutSerial::timeoutExpired,this,
-                asio::placeholders::error));
-    
     result=resultInProgress;
     bytesTransferred=0;
     for(;;)
     {
-        io.run_one();
+        runOne();
         switch(result)
         {
             case resultSuccess:
@@ -128,9 +393,113 @@ void TimeoutSerial::read(char *data, size_t size)
                 port.cancel();
                 throw(boost::system::system_error(boost::system::error_code(),
                         "Error while reading"));
+            default:
             //if resultInProgress remain in the loop
+                break;
         }
     }
+    #endif //TIMEOUTSERIAL_POLL
+}
+
+void TimeoutSerial::read(const std::vector<asio::mutable_buffer>& buffers)
+{
+    //Copy the buffer list skipping what is filled with data from a previous
+    //read, scatterBuffers is reused so this does not allocate in the long run
+    scatterBuffers.clear();
+    size_t size=0;
+    for(size_t i=0;i<buffers.size();i++)
+    {
+        asio::mutable_buffer b=buffers[i];
+        if(readData.size()>0)//If there is some data from a previous read
+        {
+            size_t toRead=min(readData.size(),b.size());
+            memcpy(b.data(),readData.data().data(),toRead);
+            readData.consume(toRead);
+            b+=toRead;
+        }
+        if(b.size()==0) continue;
+        scatterBuffers.push_back(b);
+        size+=b.size();
+    }
+    if(size==0) return;//If read data was enough, just return
+
+    #ifdef TIMEOUTSERIAL_POLL
+    chrono::steady_clock::time_point deadline=pollDeadline();
+    size_t first=0; //First buffer not yet filled
+    while(first<scatterBuffers.size())
+    {
+        const int maxIov=16;
+        struct iovec iov[maxIov];
+        int iovcnt=0;
+        for(size_t i=first;i<scatterBuffers.size() && iovcnt<maxIov;i++)
+        {
+            iov[iovcnt].iov_base=scatterBuffers[i].data();
+            iov[iovcnt].iov_len=scatterBuffers[i].size();
+            iovcnt++;
+        }
+        size_t n=pollReadv(iov,iovcnt,deadline);
+        if(n==0) throw(timeout_exception("Timeout expired"));
+        while(n>0)
+        {
+            size_t filled=min(n,scatterBuffers[first].size());
+            scatterBuffers[first]+=filled;
+            n-=filled;
+            if(scatterBuffers[first].size()==0) first++;
+        }
+    }
+    #else //TIMEOUTSERIAL_POLL
+    result=resultInProgress;
+    bytesTransferred=0;
+    transferInProgress=true;
+    asio::async_read(port,BufferRange(scatterBuffers.data(),
+            scatterBuffers.data()+scatterBuffers.size()),
+            makeAllocHandler(handlerMemory,boost::bind(
+            &TimeoutSerial::transferCompleted,this,asio::placeholders::error,
+            asio::placeholders::bytes_transferred)));
+    startTimer();
+    if(waitTransfer("Error while reading")<size)
+        throw(timeout_exception("Timeout expired"));
+    #endif //TIMEOUTSERIAL_POLL
+}
+
+size_t TimeoutSerial::readAtLeast(char *data, size_t minSize, size_t maxSize)
+{
+    if(minSize>maxSize) throw(std::invalid_argument("minSize>maxSize"));
+    size_t received=0;
+    if(readData.size()>0)//If there is some data from a previous read
+    {
+        received=min(readData.size(),maxSize);
+        memcpy(data,readData.data().data(),received);
+        readData.consume(received);
+    }
+    if(received>=minSize) return received;
+
+    #ifdef TIMEOUTSERIAL_POLL
+    chrono::steady_clock::time_point deadline=pollDeadline();
+    while(received<minSize)
+    {
+        size_t n=pollRead(data+received,maxSize-received,deadline);
+        if(n==0) break; //Timeout
+        received+=n;
+    }
+    #else //TIMEOUTSERIAL_POLL
+    result=resultInProgress;
+    bytesTransferred=0;
+    transferInProgress=true;
+    asio::async_read(port,asio::buffer(data+received,maxSize-received),
+            asio::transfer_at_least(minSize-received),
+            makeAllocHandler(handlerMemory,boost::bind(
+            &TimeoutSerial::transferCompleted,this,asio::placeholders::error,
+            asio::placeholders::bytes_transferred)));
+    startTimer();
+    received+=waitTransfer("Error while reading");
+    #endif //TIMEOUTSERIAL_POLL
+    return received;
+}
+
+size_t TimeoutSerial::readSome(char *data, size_t size)
+{
+    return readAtLeast(data,min<size_t>(1,size),size);
 }
 
 std::vector<char> TimeoutSerial::read(size_t size)
@@ -140,6 +509,12 @@ std::vector<char> TimeoutSerial::read(size_t size)
     return result;
 }
 
+void TimeoutSerial::read(std::vector<char>& data, size_t size)
+{
+    data.resize(size);//Does not allocate if capacity is enough
+    if(size>0) read(&data[0],size);
+}
+
 std::string TimeoutSerial::readString(size_t size)
 {
     string result(size,'\0');//Allocate a string with the desired size
@@ -147,50 +522,267 @@ std::string TimeoutSerial::readString(size_t size)
     return result;
 }
 
+boost::string_view TimeoutSerial::readString(std::string& result, size_t size)
+{
+    result.resize(size);//Does not allocate if capacity is enough
+    if(size>0) read(&result[0],size);
+    return result;
+}
+
 std::string TimeoutSerial::readStringUntil(const std::string& delim)
 {
+    string result;
+    readStringUntil(result,delim);
+    return result;
+}
+
+boost::string_view TimeoutSerial::readStringUntil(std::string& result,
+        const std::string& delim)
+{
+    size_t size=readUntil(delim);
+    result.assign(static_cast<const char*>(readData.data().data()),size);
+    readData.consume(size+delim.size());//Remove also the delimiter
+    return result;
+}
+
+boost::string_view TimeoutSerial::readStringUntil(char *data, size_t size,
+        const std::string& delim)
+{
+    size_t lineSize=readUntil(delim);
+    if(lineSize>size) throw(std::length_error("Line too long"));
+    memcpy(data,readData.data().data(),lineSize);
+    readData.consume(lineSize+delim.size());//Remove also the delimiter
+    return boost::string_view(data,lineSize);
+}
+
+size_t TimeoutSerial::readStringUntilAny(std::string& result,
+        const std::vector<std::string>& delims)
+{
+    if(delims.empty()) throw(std::invalid_argument("No delimiters"));
+    size_t index=0;
+    MatchCondition match=[&delims,&index](const char *begin, const char *end)
+    {
+        return matchAny(delims,index,begin,end);
+    };
+    size_t size=readUntil(match)-delims[index].size();
+    result.assign(static_cast<const char*>(readData.data().data()),size);
+    readData.consume(size+delims[index].size());//Remove also the delimiter
+    return index;
+}
+
+boost::string_view TimeoutSerial::readStringUntilMatch(std::string& result,
+        const MatchCondition& match)
+{
+    size_t size=readUntil(match);
+    result.assign(static_cast<const char*>(readData.data().data()),size);
+    readData.consume(size);
+    return result;
+}
+
+size_t TimeoutSerial::readUntilGap(char *data, size_t size,
+        std::chrono::microseconds gap)
+{
+    size_t received=0;
+    if(readData.size()>0)//If there is some data from a previous read
+    {
+        received=min(readData.size(),size);
+        memcpy(data,readData.data().data(),received);
+        readData.consume(received);
+    }
+
+    #ifdef TIMEOUTSERIAL_POLL
+    if(received==0)
+    {
+        received=pollRead(data,size,pollDeadline());
+        if(received==0) throw(timeout_exception("Timeout expired"));
+    }
+    while(received<size)
+    {
+        size_t n=pollRead(data+received,size-received,
+                chrono::steady_clock::now()+gap);
+        if(n==0) break; //Gap expired, end of frame
+        received+=n;
+    }
+    #else //TIMEOUTSERIAL_POLL
+    if(received==0)
+    {
+        //Wait for the first byte using the timeout set with setTimeout()
+        result=resultInProgress;
+        bytesTransferred=0;
+        transferInProgress=true;
+        port.async_read_some(asio::buffer(data,size),
+                makeAllocHandler(handlerMemory,boost::bind(
+                &TimeoutSerial::transferCompleted,this,asio::placeholders::error,
+                asio::placeholders::bytes_transferred)));
+        startTimer();
+        received=waitTransfer("Error while reading");
+        if(received==0) throw(timeout_exception("Timeout expired"));
+    }
+    while(received<size)
+    {
+        result=resultInProgress;
+        bytesTransferred=0;
+        transferInProgress=true;
+        port.async_read_some(asio::buffer(data+received,size-received),
+                makeAllocHandler(handlerMemory,boost::bind(
+                &TimeoutSerial::transferCompleted,this,asio::placeholders::error,
+                asio::placeholders::bytes_transferred)));
+        gapTimer.expires_after(gap);
+        gapTimer.async_wait(makeAllocHandler(handlerMemory,boost::bind(
+                &TimeoutSerial::timeoutExpired,this,asio::placeholders::error,
+                ++timerGeneration)));
+        received+=waitTransfer("Error while reading");
+        if(result==resultTimeoutExpired) break; //Gap expired, end of frame
+    }
+    #endif //TIMEOUTSERIAL_POLL
+    return received;
+}
+
+void TimeoutSerial::transact(std::vector<Transaction>& transactions,
+        size_t maxInFlight)
+{
+    size_t window=transactions.size();
+    if(maxInFlight>0) window=min(window,maxInFlight);
+    size_t sent=0;
+    for(;sent<window;sent++) writeString(transactions[sent].request);
+
+    bool aligned=true; //False after a timeout, responses may be shifted
+    for(size_t i=0;i<transactions.size();i++)
+    {
+        Transaction& t=transactions[i];
+        if(aligned)
+        {
+            try {
+                if(t.match) readStringUntilMatch(t.response,t.match);
+                else readStringUntil(t.response,t.delim);
+                t.timedOut=false;
+            } catch(timeout_exception&)
+            {
+                aligned=false;
+            }
+        }
+        if(aligned==false)
+        {
+            t.response.clear();
+            t.timedOut=true;
+            continue;
+        }
+        //A response has been received, send one more request
+        if(sent<transactions.size()) writeString(transactions[sent++].request);
+    }
+}
+
+size_t TimeoutSerial::readUntil(const std::string& delim)
+{
+    MatchCondition match=[&delim](const char *begin, const char *end)
+    {
+        const char *found=std::search(begin,end,delim.begin(),delim.end());
+        if(found!=end) return make_pair(found+delim.size(),true);
+        //The delimiter may start in the last delim.size()-1 bytes
+        size_t keep=min<size_t>(end-begin,delim.empty() ? 0 : delim.size()-1);
+        return make_pair(end-keep,false);
+    };
+    return readUntil(match)-delim.size();//Don't count delim
+}
+
+size_t TimeoutSerial::readUntil(const MatchCondition& match)
+{
+    #ifdef TIMEOUTSERIAL_POLL
+    chrono::steady_clock::time_point deadline=pollDeadline();
+    size_t searched=0; //Bytes of readData that need not be searched again
+    for(;;)
+    {
+        const char *begin=static_cast<const char*>(readData.data().data());
+        const char *end=begin+readData.size();
+        pair<const char*,bool> found=match(begin+searched,end);
+        if(found.second) return found.first-begin;
+        searched=found.first-begin;
+        size_t chunkSize=min<size_t>(512,readData.max_size()-readData.size());
+        if(chunkSize==0) throw(boost::system::system_error(
+                asio::error::no_buffer_space,"Read buffer full"));
+        char *chunk=static_cast<char*>(readData.prepare(chunkSize).data());
+        size_t n=pollRead(chunk,chunkSize,deadline);
+        if(n==0) throw(timeout_exception("Timeout expired"));
+        readData.commit(n);
+    }
+    #else //TIMEOUTSERIAL_POLL
     // Note: if readData contains some previously read data, the call to
     // async_read_until (which is done in performReadSetup) correctly handles
     // it. If the data is enough it will also immediately call readCompleted()
-    setupParameters=ReadSetupParameters(delim);
+    setupParameters=ReadSetupParameters(match);
     performReadSetup(setupParameters);
-
-    //For this code to work, there should always be a timeout, so the
-    //request for no timeout is translated into a very long timeout
-    if(timeout!=boost::posix_time::seconds(0)) timer.expires_from_now(timeout);
-    else timer.expires_from_now(boost::posix_time::hours(100000));
-
-    timer.async_wait(boost::bind(&TimeoutSerial::timeoutExpired,this,
-                asio::placeholders::error));
+    startTimer();
 
     result=resultInProgress;
     bytesTransferred=0;
     for(;;)
     {
-        io.run_one();
+        runOne();
         switch(result)
         {
             case resultSuccess:
-                {
-                    timer.cancel();
-                    bytesTransferred-=delim.size();//Don't count delim
-                    istream is(&readData);
-                    string result(bytesTransferred,'\0');//Alloc string
-                    is.read(&result[0],bytesTransferred);//Fill values
-                    is.ignore(delim.size());//Remove delimiter from stream
-                    return result;
-                }
+                timer.cancel();
+                return bytesTransferred;
             case resultTimeoutExpired:
                 port.cancel();
                 throw(timeout_exception("Timeout expired"));
             case resultError:
                 timer.cancel();
                 port.cancel();
+                //async_read_until() fails with not_found if the buffer
+                //fills up before the match, report it as the poll path does
+                if(readData.size()==readData.max_size())
+                    throw(boost::system::system_error(
+                            asio::error::no_buffer_space,"Read buffer full"));
                 throw(boost::system::system_error(boost::system::error_code(),
                         "Error while reading"));
+            default:
             //if resultInProgress remain in the loop
+                break;
+        }
+    }
+    #endif //TIMEOUTSERIAL_POLL
+}
+
+std::pair<const char*,bool> TimeoutSerial::matchAny(
+        const std::vector<std::string>& delims, size_t& index,
+        const char *begin, const char *end)
+{
+    size_t minSize=delims[0].size();
+    size_t maxSize=delims[0].size();
+    for(size_t i=1;i<delims.size();i++)
+    {
+        minSize=min(minSize,delims[i].size());
+        maxSize=max(maxSize,delims[i].size());
+    }
+
+    //Look for the match that ends first, and among the ones ending at the
+    //same position the longest, so that "OK\r\n" wins over "\r\n"
+    const char *bestEnd=0;
+    size_t bestSize=0;
+    for(const char *it=begin;it!=end;++it)
+    {
+        //A match starting here can't end before the best one found so far
+        if(bestEnd && it+minSize>=bestEnd) break;
+        for(size_t i=0;i<delims.size();i++)
+        {
+            const string& d=delims[i];
+            if(static_cast<size_t>(end-it)<d.size()) continue;
+            if(memcmp(it,d.data(),d.size())!=0) continue;
+            const char *matchEnd=it+d.size();
+            if(bestEnd==0 || matchEnd<bestEnd ||
+               (matchEnd==bestEnd && d.size()>bestSize))
+            {
+                bestEnd=matchEnd;
+                bestSize=d.size();
+                index=i;
+            }
         }
     }
+    if(bestEnd) return make_pair(bestEnd,true);
+    //Any delimiter may still start in the last maxSize-1 bytes
+    size_t keep=min<size_t>(end-begin,maxSize>0 ? maxSize-1 : 0);
+    return make_pair(end-keep,false);
 }
 
 TimeoutSerial::~TimeoutSerial() {}
@@ -199,19 +791,89 @@ void TimeoutSerial::performReadSetup(const ReadSetupParameters& param)
 {
     if(param.fixedSize)
     {
-        asio::async_read(port,asio::buffer(param.data,param.size),boost::bind(
+        asio::async_read(port,asio::buffer(param.data,param.size),
+                makeAllocHandler(handlerMemory,boost::bind(
                 &TimeoutSerial::readCompleted,this,asio::placeholders::error,
-                asio::placeholders::bytes_transferred));
+                asio::placeholders::bytes_transferred)));
     } else {
-        asio::async_read_until(port,readData,param.delim,boost::bind(
+        asio::async_read_until(port,readData,MatchConditionAdapter(*param.match),
+                makeAllocHandler(handlerMemory,boost::bind(
                 &TimeoutSerial::readCompleted,this,asio::placeholders::error,
-                asio::placeholders::bytes_transferred));
+                asio::placeholders::bytes_transferred)));
+    }
+}
+
+void TimeoutSerial::startTimer()
+{
+    //For this code to work, there should always be a timeout, so the
+    //request for no timeout is translated into a very long timeout
+    if(timeout!=boost::posix_time::seconds(0)) timer.expires_from_now(timeout);
+    else timer.expires_from_now(boost::posix_time::hours(100000));
+
+    timer.async_wait(makeAllocHandler(handlerMemory,boost::bind(
+                &TimeoutSerial::timeoutExpired,this,asio::placeholders::error,
+                ++timerGeneration)));
+}
+
+size_t TimeoutSerial::waitTransfer(const char *errorMessage)
+{
+    for(;;)
+    {
+        runOne();
+        switch(result)
+        {
+            case resultSuccess:
+                timer.cancel();
+                gapTimer.cancel();
+                return bytesTransferred;
+            case resultTimeoutExpired:
+                port.cancel();
+                //Wait for the cancelled operation to complete, as its
+                //handler reports how many bytes were transferred. This may
+                //leave the io_service out of work, hence the reset
+                while(transferInProgress) io.run_one();
+                io.reset();
+                return bytesTransferred;
+            case resultError:
+                timer.cancel();
+                gapTimer.cancel();
+                port.cancel();
+                throw(boost::system::system_error(boost::system::error_code(),
+                        errorMessage));
+            default:
+            //if resultInProgress remain in the loop
+                break;
+        }
+    }
+}
+
+void TimeoutSerial::runOne()
+{
+    if(busyPoll!=chrono::steady_clock::duration::zero())
+    {
+        chrono::steady_clock::time_point until=
+                spinDeadline(chrono::steady_clock::time_point::max());
+        do {
+            if(io.poll_one()>0) return;
+        } while(chrono::steady_clock::now()<until);
     }
+    io.run_one();
 }
 
-void TimeoutSerial::timeoutExpired(const boost::system::error_code& error)
+std::chrono::steady_clock::time_point TimeoutSerial::spinDeadline(
+        std::chrono::steady_clock::time_point deadline) const
 {
-     if(!error && result==resultInProgress) result=resultTimeoutExpired;
+    if(busyPoll==chrono::steady_clock::duration::max()) return deadline;
+    chrono::steady_clock::time_point now=chrono::steady_clock::now();
+    if(deadline-now<busyPoll) return deadline;
+    return now+busyPoll;
+}
+
+void TimeoutSerial::timeoutExpired(const boost::system::error_code& error,
+        unsigned int generation)
+{
+     if(!error && generation==timerGeneration && result==resultInProgress)
+         result=resultTimeoutExpired;
 }
 
 void TimeoutSerial::readCompleted(const boost::system::error_code& error,
@@ -242,3 +904,115 @@ void TimeoutSerial::readCompleted(const boost::system::error_code& error,
 
     result=resultError;
 }
+
+void TimeoutSerial::transferCompleted(const boost::system::error_code& error,
+        const size_t bytesTransferred)
+{
+    transferInProgress=false;
+    this->bytesTransferred=bytesTransferred;
+    if(!error) result=resultSuccess;
+    else if(result!=resultTimeoutExpired) result=resultError;
+    //else cancelled because of a timeout, bytesTransferred is what got done
+}
+
+#ifdef TIMEOUTSERIAL_POLL
+
+size_t TimeoutSerial::pollRead(char *data, size_t size,
+        std::chrono::steady_clock::time_point deadline)
+{
+    struct iovec iov;
+    iov.iov_base=data;
+    iov.iov_len=size;
+    return pollReadv(&iov,1,deadline);
+}
+
+size_t TimeoutSerial::pollReadv(const struct iovec *iov, int iovcnt,
+        std::chrono::steady_clock::time_point deadline)
+{
+    const int fd=port.native_handle();
+    //When busy polling, keep reading without sleeping until it ends
+    const bool busy=busyPoll!=chrono::steady_clock::duration::zero();
+    chrono::steady_clock::time_point spinUntil;
+    if(busy) spinUntil=spinDeadline(deadline);
+    for(;;)
+    {
+        ssize_t n=::readv(fd,iov,iovcnt);
+        if(n>0) return n;
+        if(n==0) throw(boost::system::system_error(boost::system::error_code(),
+                "Error while reading"));
+        if(errno==EINTR) continue;
+        if(errno!=EAGAIN && errno!=EWOULDBLOCK)
+            throw(boost::system::system_error(boost::system::error_code(
+                errno,boost::system::system_category()),"Error while reading"));
+        if(busy && chrono::steady_clock::now()<spinUntil) continue;
+
+        struct pollfd pfd;
+        pfd.fd=fd;
+        pfd.events=POLLIN;
+        pfd.revents=0;
+        struct timespec ts;
+        struct timespec *tsp=0; //Wait forever
+        if(deadline!=chrono::steady_clock::time_point::max())
+        {
+            chrono::nanoseconds remaining=deadline-chrono::steady_clock::now();
+            if(remaining<=chrono::nanoseconds::zero()) return 0;
+            ts.tv_sec=chrono::duration_cast<chrono::seconds>(remaining).count();
+            ts.tv_nsec=(remaining-chrono::seconds(ts.tv_sec)).count();
+            tsp=&ts;
+        }
+        if(ppoll(&pfd,1,tsp,0)<0 && errno!=EINTR)
+            throw(boost::system::system_error(boost::system::error_code(
+                errno,boost::system::system_category()),"Error while reading"));
+        if(pfd.revents & (POLLERR | POLLNVAL))
+            throw(boost::system::system_error(boost::system::error_code(),
+                "Error while reading"));
+        //Go on reading, if the deadline has expired the next poll will tell
+    }
+}
+
+size_t TimeoutSerial::pollWrite(const char *data, size_t size,
+        std::chrono::steady_clock::time_point deadline)
+{
+    const int fd=port.native_handle();
+    for(;;)
+    {
+        ssize_t n=::write(fd,data,size);
+        if(n>0) return n;
+        if(n<0 && errno==EINTR) continue;
+        if(n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK)
+            throw(boost::system::system_error(boost::system::error_code(
+                errno,boost::system::system_category()),"Error while writing"));
+
+        struct pollfd pfd;
+        pfd.fd=fd;
+        pfd.events=POLLOUT;
+        pfd.revents=0;
+        struct timespec ts;
+        struct timespec *tsp=0; //Wait forever
+        if(deadline!=chrono::steady_clock::time_point::max())
+        {
+            chrono::nanoseconds remaining=deadline-chrono::steady_clock::now();
+            if(remaining<=chrono::nanoseconds::zero()) return 0;
+            ts.tv_sec=chrono::duration_cast<chrono::seconds>(remaining).count();
+            ts.tv_nsec=(remaining-chrono::seconds(ts.tv_sec)).count();
+            tsp=&ts;
+        }
+        if(ppoll(&pfd,1,tsp,0)<0 && errno!=EINTR)
+            throw(boost::system::system_error(boost::system::error_code(
+                errno,boost::system::system_category()),"Error while writing"));
+        if(pfd.revents & (POLLERR | POLLNVAL))
+            throw(boost::system::system_error(boost::system::error_code(),
+                "Error while writing"));
+        //Go on writing, if the deadline has expired the next poll will tell
+    }
+}
+
+std::chrono::steady_clock::time_point TimeoutSerial::pollDeadline() const
+{
+    if(timeout==boost::posix_time::seconds(0))
+        return chrono::steady_clock::time_point::max();
+    return chrono::steady_clock::now()+chrono::microseconds(
+            timeout.total_microseconds());
+}
+
+#endif //TIMEOUTSERIAL_POLL
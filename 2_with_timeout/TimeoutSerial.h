@@ -10,7 +10,12 @@
 #define	TIMEOUTSERIAL_H
 
 #include <stdexcept>
+#include <chrono>
+#include <utility>
+#include <functional>
+#include <type_traits>
 #include <boost/utility.hpp>
+#include <boost/utility/string_view.hpp>
 #include <boost/asio.hpp>
 
 /**
@@ -24,6 +29,10 @@ public:
 
 /**
  * Serial port class, with timeout on read operations.
+ * On Linux, defining TIMEOUTSERIAL_POLL selects a backend that implements
+ * the timeouts with non-blocking reads and ppoll() on the file descriptor
+ * instead of running the io_service for every operation. This has lower
+ * latency for short request/response exchanges.
  */
 class TimeoutSerial: private boost::noncopyable
 {
@@ -83,6 +92,14 @@ public:
      */
     bool isOpen() const;
 
+    /**
+     * On Linux open() accepts any integer baud rate, not just the standard
+     * ones, as long as the driver supports it
+     * \return the baud rate applied by the last open(), as reported by the
+     * driver, that may have rounded it to what the hardware can generate
+     */
+    unsigned int getBaudRate() const;
+
     /**
      * Close the serial device
      * \throws boost::system::system_error if any error
@@ -95,11 +112,25 @@ public:
      */
     void setTimeout(const boost::posix_time::time_duration& t);
 
+    /**
+     * Busy polling, for the lowest latency at the cost of CPU time.
+     * Reads keep checking for data without sleeping for up to the given
+     * time before waiting for it, so that they don't pay for a wakeup and a
+     * context switch if data arrives in the meantime.
+     * The timeout set with setTimeout() still applies.
+     * \param t how long to poll before sleeping, zero (the default) to
+     * disable, boost::posix_time::pos_infin to never sleep, for a thread
+     * having a dedicated CPU core
+     * \throws std::invalid_argument if t is negative or not a valid time
+     */
+    void setBusyPoll(const boost::posix_time::time_duration& t);
+
     /**
      * Write data
      * \param data array of char to be sent through the serial device
      * \param size array size
      * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
      */
     void write(const char *data, size_t size);
 
@@ -107,6 +138,7 @@ public:
      * Write data
      * \param data to be sent through the serial device
      * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
      */
     void write(const std::vector<char>& data);
 
@@ -115,9 +147,21 @@ public:
     * To send binary data, use write()
     * \param s string to send
     * \throws boost::system::system_error if any error
+    * \throws timeout_exception in case of timeout
     */
     void writeString(const std::string& s);
 
+    /**
+     * Write data, blocking until all of it is written or the timeout expires.
+     * Unlike write(), a timeout is not an error, so that the caller knows
+     * how much data went out and can resume the transfer.
+     * \param data array of char to be sent through the serial device
+     * \param size array size
+     * \return number of bytes written, less than size if the timeout expired
+     * \throws boost::system::system_error if any error
+     */
+    size_t writeSome(const char *data, size_t size);
+
     /**
      * Read some data, blocking
      * \param data array of char to be read through the serial device
@@ -128,6 +172,39 @@ public:
      */
     void read(char *data, size_t size);
 
+    /**
+     * Scatter read, blocking. Fills the buffers in order with a single
+     * timeout, so that for example a header and a payload can be read
+     * directly where they belong, without copying them out of a temporary.
+     * \param buffers where to store the received data
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     */
+    void read(const std::vector<boost::asio::mutable_buffer>& buffers);
+
+    /**
+     * Read at least minSize bytes and up to maxSize, blocking until minSize
+     * bytes have arrived or the timeout expires.
+     * Unlike read(), a timeout is not an error, so that the caller knows
+     * how much data arrived and can resume a slow transfer.
+     * \param data array of char where the received data is stored
+     * \param minSize minimum number of bytes to read
+     * \param maxSize array size, must be >= minSize
+     * \return number of bytes read, less than minSize if the timeout expired
+     * \throws boost::system::system_error if any error
+     */
+    size_t readAtLeast(char *data, size_t minSize, size_t maxSize);
+
+    /**
+     * Read some data, blocking until at least one byte has arrived or the
+     * timeout expires. Same as readAtLeast(data,1,size)
+     * \param data array of char where the received data is stored
+     * \param size array size
+     * \return number of bytes read, 0 if the timeout expired
+     * \throws boost::system::system_error if any error
+     */
+    size_t readSome(char *data, size_t size);
+
     /**
      * Read some data, blocking
      * \param size how much data to read
@@ -137,6 +214,18 @@ public:
      */
     std::vector<char> read(size_t size);
 
+    /**
+     * Read some data, blocking
+     * Same as read(size), but the data is stored in a caller provided vector,
+     * whose capacity is reused so that no memory allocation takes place
+     * \param data vector where the received data is stored, it is resized to
+     * size
+     * \param size how much data to read
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     */
+    void read(std::vector<char>& data, size_t size);
+
     /**
      * Read a string, blocking
      * Can only be used if the user is sure that the serial device will not
@@ -149,6 +238,18 @@ public:
      */
     std::string readString(size_t size);
 
+    /**
+     * Read a string, blocking
+     * Same as readString(size), but the data is stored in a caller provided
+     * string, whose capacity is reused so that no memory allocation takes place
+     * \param result string where the received data is stored
+     * \param size hw much data to read
+     * \return a view of result
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     */
+    boost::string_view readString(std::string& result, size_t size);
+
     /**
      * Read a line, blocking
      * Can only be used if the user is sure that the serial device will not
@@ -162,10 +263,201 @@ public:
      */
     std::string readStringUntil(const std::string& delim="\n");
 
-    
+    /**
+     * Read a line, blocking
+     * Same as readStringUntil(delim), but the line is stored in a caller
+     * provided string, whose capacity is reused so that no memory allocation
+     * takes place
+     * \param result string where the received line is stored. The delimiter
+     * is removed from the string.
+     * \param delim line delimiter
+     * \return a view of result
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     */
+    boost::string_view readStringUntil(std::string& result,
+            const std::string& delim);
+
+    /**
+     * Read a line, blocking
+     * Same as readStringUntil(delim), but the line is stored in a caller
+     * provided buffer, so no memory allocation takes place
+     * \param data buffer where the received line is stored. The delimiter
+     * is removed and no '\0' is added.
+     * \param size buffer size
+     * \param delim line delimiter
+     * \return a view of the line stored in data
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     * \throws std::length_error if the line does not fit in the buffer. In
+     * this case the line is not consumed, and can be read again with a larger
+     * buffer
+     */
+    boost::string_view readStringUntil(char *data, size_t size,
+            const std::string& delim);
+
+    /**
+     * Read until any of a set of delimiters, blocking
+     * Can only be used if the user is sure that the serial device will not
+     * send binary data. For binary data read, use read()
+     * If more delimiters are found, the one ending first in the received
+     * data wins, and among the ones ending at the same position the longest,
+     * so with {"\r\n","OK\r\n"} the input "OK\r\n" matches "OK\r\n".
+     * \param result string where the received data is stored. The delimiter
+     * is removed from the string.
+     * \param delims possible delimiters, must not be empty
+     * \return the index in delims of the delimiter that was found
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     */
+    size_t readStringUntilAny(std::string& result,
+            const std::vector<std::string>& delims);
+
+    /**
+     * Read a frame delimited by a silence on the line, blocking
+     * Waits for the first byte as long as the timeout set with setTimeout(),
+     * then keeps reading until no byte arrives for longer than gap, as
+     * required by protocols such as Modbus RTU, that end a frame after 3.5
+     * character times of silence. The gap is measured with a monotonic clock.
+     * \param data array of char where the frame is stored
+     * \param size array size. If the frame is longer, the first size bytes
+     * are returned and the rest is returned by the next read
+     * \param gap silence that ends a frame
+     * \return frame size, 0<return<=size
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception if the first byte does not arrive in time
+     */
+    size_t readUntilGap(char *data, size_t size, std::chrono::microseconds gap);
+
+    /**
+     * Match condition, called with the received data that has not been
+     * consumed yet, starting from where the previous call left off.
+     * If a match is found it returns a pointer one past the end of the
+     * match and true, otherwise it returns the position from where the
+     * search should resume when more data arrives and false.
+     * This is the same convention as the match conditions of
+     * boost::asio::read_until
+     */
+    typedef std::function<std::pair<const char*,bool> (const char*,
+            const char*)> MatchCondition;
+
+    /**
+     * Read until a match condition is satisfied, blocking
+     * \param result string where the received data is stored, up to the
+     * end of the match
+     * \param match the match condition
+     * \return a view of result
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     */
+    boost::string_view readStringUntilMatch(std::string& result,
+            const MatchCondition& match);
+
+    /**
+     * A request/response exchange, used by transact().
+     * Just wrapper class, no encapsulation provided
+     */
+    class Transaction
+    {
+    public:
+        Transaction(): request(), delim("\n"), match(), response(),
+                timedOut(false) {}
+
+        Transaction(const std::string& request, const std::string& delim="\n"):
+                request(request), delim(delim), match(), response(),
+                timedOut(false) {}
+
+        Transaction(const std::string& request, const MatchCondition& match):
+                request(request), delim(), match(match), response(),
+                timedOut(false) {}
+
+        //Using default copy constructor, operator=
+
+        std::string request; ///< Data to send
+        std::string delim; ///< Response delimiter (valid if match is empty)
+        MatchCondition match; ///< Response match condition, if not empty
+        std::string response; ///< Received response, set by transact()
+        bool timedOut; ///< True if response did not arrive, set by transact()
+    };
+
+    /**
+     * Perform a batch of request/response exchanges, pipelining them.
+     * Requests are sent back-to-back without waiting for the responses,
+     * which are then matched in order, so a batch costs about one round
+     * trip instead of one per request.
+     * The timeout applies to each response, starting when waiting for it
+     * begins. After a response times out the following ones can't be told
+     * apart from it if it arrives late, so the batch stops there: the rest
+     * of the transactions are marked as timed out and their requests are not
+     * sent. Responses to requests already sent may still arrive, so resync
+     * with the device before the next exchange.
+     * \param transactions the exchanges to perform. The response and
+     * timedOut fields are filled in, reusing the response string capacity.
+     * The response is stored as readStringUntil() or readStringUntilMatch()
+     * would return it.
+     * \param maxInFlight maximum number of requests sent whose response has
+     * not yet been received, 0 for no limit. Use it if the device can only
+     * queue a limited number of commands.
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception if a request can't be written in time
+     */
+    void transact(std::vector<Transaction>& transactions, size_t maxInFlight=0);
+
     ~TimeoutSerial();
 
+    /**
+     * Maximum size of the buffer holding received data that has not yet been
+     * consumed. Reading a line longer than this throws
+     * boost::system::system_error with boost::asio::error::no_buffer_space.
+     */
+    static const size_t readBufferMaxSize=65536;
+
 private:
+    /**
+     * Memory used to allocate asio handlers, so that no memory allocation
+     * takes place when setting up a read operation. There are a few slots
+     * because the handler of a cancelled operation is released only the next
+     * time the io_service runs.
+     */
+    class HandlerMemory: private boost::noncopyable
+    {
+    public:
+        HandlerMemory();
+
+        /**
+         * \return memory from a free slot, or from the heap if size is too
+         * large or no slot is free
+         */
+        void *allocate(size_t size);
+
+        /**
+         * Release memory obtained with allocate()
+         */
+        void deallocate(void *p);
+
+    private:
+        static const int numSlots=4;
+        static const size_t slotSize=512;
+        std::aligned_storage<slotSize>::type slots[numSlots];
+        bool inUse[numSlots];
+    };
+
+    /**
+     * Allocator for asio handlers that takes memory from a HandlerMemory
+     */
+    template<typename T> class HandlerAllocator;
+
+    /**
+     * Wraps an asio handler, associating a HandlerAllocator to it
+     */
+    template<typename Handler> class AllocHandler;
+
+    /**
+     * \return handler wrapped so that it is allocated from memory
+     */
+    template<typename Handler>
+    static AllocHandler<Handler> makeAllocHandler(HandlerMemory& memory,
+            const Handler& handler);
 
     /**
      * Parameters of performReadSetup.
@@ -174,18 +466,18 @@ private:
     class ReadSetupParameters
     {
     public:
-        ReadSetupParameters(): fixedSize(false), delim(""), data(0), size(0) {}
+        ReadSetupParameters(): fixedSize(false), match(0), data(0), size(0) {}
 
-        explicit ReadSetupParameters(const std::string& delim):
-                fixedSize(false), delim(delim), data(0), size(0) { }
+        explicit ReadSetupParameters(const MatchCondition& match):
+                fixedSize(false), match(&match), data(0), size(0) { }
 
         ReadSetupParameters(char *data, size_t size): fixedSize(true),
-                delim(""), data(data), size(size) { }
+                match(0), data(data), size(size) { }
 
         //Using default copy constructor, operator=
 
         bool fixedSize; ///< True if need to read a fixed number of parameters
-        std::string delim; ///< String end delimiter (valid if fixedSize=false)
+        const MatchCondition *match; ///< End condition (valid if fixedSize=false)
         char *data; ///< Pointer to data array (valid if fixedSize=true)
         size_t size; ///< Array size (valid if fixedSize=true)
     };
@@ -196,11 +488,44 @@ private:
      */
     void performReadSetup(const ReadSetupParameters& param);
 
+    /**
+     * Blocks until delim is found in readData.
+     * \return the number of bytes at the beginning of readData that precede
+     * the delimiter. Data is not consumed.
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     */
+    size_t readUntil(const std::string& delim);
+
+    /**
+     * Blocks until match is satisfied by the data in readData.
+     * \return the number of bytes at the beginning of readData up to the end
+     * of the match. Data is not consumed.
+     * \throws boost::system::system_error if any error
+     * \throws timeout_exception in case of timeout
+     */
+    size_t readUntil(const MatchCondition& match);
+
+    /**
+     * Match condition used by readStringUntilAny()
+     * \param delims possible delimiters
+     * \param index set to the index of the delimiter found
+     * \param begin data to search
+     * \param end end of the data to search
+     */
+    static std::pair<const char*,bool> matchAny(
+            const std::vector<std::string>& delims, size_t& index,
+            const char *begin, const char *end);
+
     /**
      * Callack called either when the read timeout is expired or canceled.
-     * If called because timeout expired, sets result to resultTimeoutExpired
+     * If called because timeout expired, sets result to resultTimeoutExpired.
+     * A timer can expire right before being cancelled, so expirations of
+     * timers started before the current one are ignored
+     * \param generation value of timerGeneration when the timer was started
      */
-    void timeoutExpired(const boost::system::error_code& error);
+    void timeoutExpired(const boost::system::error_code& error,
+            unsigned int generation);
 
     /**
      * Callback called either if a read complete or read error occurs
@@ -211,7 +536,86 @@ private:
             const size_t bytesTransferred);
 
     /**
-     * Possible outcome of a read. Set by callbacks, read from main code
+     * Callback called when a read or write started by the caller of
+     * waitTransfer() completes, is cancelled or fails.
+     * If called because of transfer complete, sets result to resultSuccess
+     * If called because transfer error, sets result to resultError
+     * In any case records the bytes transferred
+     */
+    void transferCompleted(const boost::system::error_code& error,
+            const size_t bytesTransferred);
+
+    /**
+     * Sets up timer according to the timeout set with setTimeout()
+     */
+    void startTimer();
+
+    /**
+     * Runs the io_service until the operation whose callback is
+     * transferCompleted() completes, or timer or gapTimer expire.
+     * In this last case the operation is cancelled and result is set to
+     * resultTimeoutExpired.
+     * \param errorMessage message of the exception thrown on error
+     * \return the bytes transferred, also if the operation was cancelled
+     * \throws boost::system::system_error if any error
+     */
+    size_t waitTransfer(const char *errorMessage);
+
+    /**
+     * Runs one handler of the io_service, busy polling first if enabled
+     */
+    void runOne();
+
+    /**
+     * \param deadline when the operation gives up, time_point::max() for
+     * never
+     * \return when busy polling for an operation starting now ends
+     */
+    std::chrono::steady_clock::time_point spinDeadline(
+            std::chrono::steady_clock::time_point deadline) const;
+
+    #ifdef TIMEOUTSERIAL_POLL
+    /**
+     * Used by the poll backend. Waits until some data is available or the
+     * deadline expires, then reads what is available.
+     * \param data where to store the read data
+     * \param size maximum number of bytes to read
+     * \param deadline when to give up, time_point::max() to wait forever
+     * \return number of bytes read, 0 if the deadline expired
+     * \throws boost::system::system_error if any error
+     */
+    size_t pollRead(char *data, size_t size,
+            std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * Used by the poll backend. Same as pollRead(), but scatters the data
+     * in multiple buffers with readv()
+     */
+    size_t pollReadv(const struct iovec *iov, int iovcnt,
+            std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * Used by the poll backend. Waits until the port is writable or the
+     * deadline expires, then writes as much as possible.
+     * \param data data to write
+     * \param size number of bytes to write
+     * \param deadline when to give up, time_point::max() to wait forever
+     * \return number of bytes written, 0 if the deadline expired
+     * \throws boost::system::system_error if any error
+     */
+    size_t pollWrite(const char *data, size_t size,
+            std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * Used by the poll backend.
+     * \return the deadline for an operation starting now
+     */
+    std::chrono::steady_clock::time_point pollDeadline() const;
+    #endif //TIMEOUTSERIAL_POLL
+
+    /**
+     * Possible outcome of a read or write. Set by callbacks, read from main
+     * code
      */
     enum ReadResult
     {
@@ -224,11 +628,20 @@ private:
     boost::asio::io_service io; ///< Io service object
     boost::asio::serial_port port; ///< Serial port object
     boost::asio::deadline_timer timer; ///< Timer for timeout
+    boost::asio::steady_timer gapTimer; ///< Timer for inter-byte gap
+    unsigned int timerGeneration; ///< Incremented each time a timer starts
     boost::posix_time::time_duration timeout; ///< Read/write timeout
+    /// Busy polling time, duration::max() to never sleep
+    std::chrono::steady_clock::duration busyPoll;
+    unsigned int baudRate; ///< Baud rate applied by the last open()
     boost::asio::streambuf readData; ///< Holds eventual read but not consumed
     enum ReadResult result;  ///< Used by read with timeout
-    size_t bytesTransferred; ///< Used by async read callback
+    size_t bytesTransferred; ///< Used by async read/write callbacks
+    bool transferInProgress; ///< True until transferCompleted() is called
     ReadSetupParameters setupParameters; ///< Global because used in the OSX fix
+    HandlerMemory handlerMemory; ///< Memory for asio handlers
+    /// Buffers still to be filled by scatter read, kept to reuse its memory
+    std::vector<boost::asio::mutable_buffer> scatterBuffers;
 };
 
 #endif  //TIMEOUTSERIAL_H
@@ -0,0 +1,61 @@
+/*
+ * Baud rate test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal driven by this program.
+ * Opens the port at standard and non-standard rates, and checks that
+ * getBaudRate() reads back the requested rate, that standard rates are still
+ * visible to tcgetattr(), and that data goes through. Built with the backend
+ * selected by TIMEOUTSERIAL_POLL. Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <termios.h>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial;
+        serial.setTimeout(boost::posix_time::seconds(2));
+        const unsigned int rates[]={9600,115200,250000,1000000,12000000};
+        for(unsigned int rate : rates)
+        {
+            string name=to_string(rate);
+            serial.open(pty.name(),rate);
+            check(serial.getBaudRate()==rate,name+": wrong rate read back");
+            termios t;
+            check(tcgetattr(pty.slave(),&t)==0,name+": tcgetattr");
+            if(rate==9600) check(cfgetospeed(&t)==B9600,name+": not B9600");
+            if(rate==115200)
+                check(cfgetospeed(&t)==B115200,name+": not B115200");
+            pty.write("ping");
+            check(serial.readString(4)=="ping",name+": read");
+            serial.writeString("pong");
+            check(pty.read(4,chrono::seconds(2))=="pong",name+": write");
+            serial.close();
+        }
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
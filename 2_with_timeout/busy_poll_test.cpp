@@ -0,0 +1,89 @@
+/*
+ * Busy polling test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal driven by this program.
+ * Checks that reads get their data and that the timeout still fires when
+ * busy polling for a while and when never sleeping, and that invalid
+ * polling times are rejected. Built with the backend selected by
+ * TIMEOUTSERIAL_POLL. Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::milliseconds(100));
+        bool invalid=false;
+        try {
+            serial.setBusyPoll(boost::posix_time::microseconds(-1));
+        } catch(invalid_argument&)
+        {
+            invalid=true;
+        }
+        check(invalid,"negative busy polling time accepted");
+
+        const boost::posix_time::time_duration modes[]={
+            boost::posix_time::microseconds(50),
+            boost::posix_time::time_duration(boost::posix_time::pos_infin),
+            boost::posix_time::microseconds(0)};
+        const char *names[]={"50us","forever","disabled"};
+        for(int i=0;i<3;i++)
+        {
+            serial.setBusyPoll(modes[i]);
+            string name=names[i];
+            for(int j=0;j<100;j++)
+            {
+                pty.write("ping");
+                if(serial.readString(4)!="ping")
+                {
+                    check(false,name+": wrong data");
+                    break;
+                }
+            }
+            pty.write("line\n");
+            check(serial.readStringUntil("\n")=="line",name+": line read");
+
+            auto start=chrono::steady_clock::now();
+            bool timedOut=false;
+            try {
+                serial.readString(1);
+            } catch(timeout_exception&)
+            {
+                timedOut=true;
+            }
+            auto waited=chrono::steady_clock::now()-start;
+            check(timedOut,name+": read did not time out");
+            check(waited>=chrono::milliseconds(90),name+": timed out early");
+            check(waited<chrono::seconds(2),name+": timed out late");
+        }
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
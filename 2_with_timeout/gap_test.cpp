@@ -0,0 +1,99 @@
+/*
+ * Back-to-back readUntilGap() test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal written by this program in
+ * bursts shaped like a two part frame followed shortly by the next frame,
+ * which makes the inter-byte gap expire close to data arriving. Every frame
+ * must be returned whole, and no read may time out, as the timeout set with
+ * setTimeout() is far longer than any pause. A frame glued to the next one is
+ * tolerated a few times, as the reader can be descheduled for longer than the
+ * pause on a loaded machine. Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static const int frames=150;
+static const chrono::microseconds gap(1000);
+static const int maxGlued=3; ///< Glued frames tolerated, due to the scheduler
+
+/**
+ * Write the frames, each as "ABCD", a pause shorter than the gap, "EFGH",
+ * then "NEXT" after a pause longer than the gap
+ */
+static void device(PseudoTerminal& pty)
+{
+    for(int i=0;i<frames;i++)
+    {
+        if(pty.write("ABCD")==false) return;
+        this_thread::sleep_for(chrono::microseconds(100));
+        if(pty.write("EFGH")==false) return;
+        this_thread::sleep_for(chrono::milliseconds(5));
+        if(pty.write("NEXT")==false) return;
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+}
+
+int main()
+{
+    int failures=0;
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::milliseconds(500));
+        thread writer(device,ref(pty));
+        //On a loaded machine the first pause may exceed the gap and split a
+        //frame in two, and "NEXT" may arrive before the reader runs again.
+        //Spurious timeouts are always a failure
+        string received;
+        int glued=0;
+        const size_t total=frames*12;
+        while(received.size()<total)
+        {
+            char frame[64];
+            auto start=chrono::steady_clock::now();
+            size_t n;
+            try {
+                n=serial.readUntilGap(frame,sizeof(frame),gap);
+            } catch(timeout_exception&)
+            {
+                auto waited=chrono::steady_clock::now()-start;
+                cout<<"Timeout after "<<chrono::duration_cast<
+                    chrono::microseconds>(waited).count()<<"us"<<endl;
+                failures++;
+                if(waited>chrono::milliseconds(400)) break; //Real timeout
+                continue;
+            }
+            string s(frame,n);
+            size_t next=s.find("NEXT");
+            if(next!=string::npos && next!=0)
+            {
+                cout<<"Frame glued to the next one: "<<s<<endl;
+                if(++glued==maxGlued+1) failures++;
+            }
+            received+=s;
+        }
+        writer.join();
+        string expected;
+        for(int i=0;i<frames;i++) expected+="ABCDEFGHNEXT";
+        if(received!=expected)
+        {
+            cout<<"Received data differs from what was sent"<<endl;
+            failures++;
+        }
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+/*
+ * Round trip latency benchmark for TimeoutSerial.
+ * The other end of the port is a pseudo terminal echoed back by a thread of
+ * this program, that times how long a message takes to come back, then how
+ * long a read with a 50ms timeout takes to time out. Built with the backend
+ * selected by TIMEOUTSERIAL_POLL. Linux only, as it uses a pseudo terminal.
+ * Arguments, in any order:
+ * - busy=N to busy poll for N microseconds, "busy=forever" to never sleep
+ * - bytes=N message size, default 32, samples=N, default 20000
+ */
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+/**
+ * \return the value of a name=value argument, or nullptr if not given
+ */
+static const char *option(int argc, char *argv[], const char *name)
+{
+    size_t len=strlen(name);
+    for(int i=1;i<argc;i++)
+        if(strncmp(argv[i],name,len)==0 && argv[i][len]=='=')
+            return argv[i]+len+1;
+    return nullptr;
+}
+
+/**
+ * \return the value of a numeric name=value argument, or def if not given
+ */
+static size_t option(int argc, char *argv[], const char *name, size_t def)
+{
+    const char *value=option(argc,argv,name);
+    return value ? strtoul(value,nullptr,10) : def;
+}
+
+/**
+ * \return the busy polling time given as busy=N microseconds or
+ * busy=forever, zero if not given
+ */
+static boost::posix_time::time_duration busyPoll(int argc, char *argv[])
+{
+    const char *value=option(argc,argv,"busy");
+    if(value==nullptr) return boost::posix_time::microseconds(0);
+    if(strcmp(value,"forever")==0)
+        return boost::posix_time::time_duration(boost::posix_time::pos_infin);
+    return boost::posix_time::microseconds(atoi(value));
+}
+
+/**
+ * Write back everything read from the master side, until the port hangs up
+ */
+static void echo(int fd)
+{
+    char buffer[256];
+    ssize_t n;
+    while((n=read(fd,buffer,sizeof(buffer)))>0)
+        if(write(fd,buffer,n)!=n) return;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t bytes=option(argc,argv,"bytes",32);
+    const size_t samples=option(argc,argv,"samples",20000);
+    vector<double> rtt;
+    double timeout=0;
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::milliseconds(50));
+        serial.setBusyPoll(busyPoll(argc,argv));
+        thread echoThread(echo,pty.master());
+        vector<char> message(bytes,'x');
+        vector<char> reply(bytes);
+        for(size_t i=0;i<samples;i++)
+        {
+            auto start=chrono::steady_clock::now();
+            serial.write(message.data(),bytes);
+            serial.read(reply.data(),bytes);
+            rtt.push_back(chrono::duration<double,micro>(
+                chrono::steady_clock::now()-start).count());
+        }
+        auto start=chrono::steady_clock::now();
+        try {
+            serial.read(reply.data(),1);
+        } catch(timeout_exception&)
+        {
+            timeout=chrono::duration<double,milli>(
+                chrono::steady_clock::now()-start).count();
+        }
+        serial.close();
+        pty.closeSlave(); //Hang up, echoThread returns
+        echoThread.join();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+
+    sort(rtt.begin(),rtt.end());
+    #ifdef TIMEOUTSERIAL_POLL
+    cout<<"poll backend"<<endl;
+    #else //TIMEOUTSERIAL_POLL
+    cout<<"asio backend"<<endl;
+    #endif //TIMEOUTSERIAL_POLL
+    cout<<"round trip us\tp50\tp90\tp99\tp99.9\tmax"<<endl;
+    cout<<"\t\t"<<rtt[rtt.size()/2]<<"\t"<<rtt[rtt.size()*90/100]<<"\t"
+        <<rtt[rtt.size()*99/100]<<"\t"<<rtt[rtt.size()*999/1000]<<"\t"
+        <<rtt.back()<<endl;
+    cout<<"50ms timeout fired after "<<timeout<<"ms"<<endl;
+}
@@ -0,0 +1,105 @@
+/*
+ * Multi-delimiter and match condition read test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal written by this program.
+ * Checks which delimiter readStringUntilAny() picks, and that
+ * readStringUntilMatch() finds length prefixed frames also when they arrive
+ * in pieces. Built with the backend selected by TIMEOUTSERIAL_POLL.
+ * Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <utility>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Match a frame made of a length byte followed by that many bytes
+ */
+static pair<const char*,bool> frame(const char *begin, const char *end)
+{
+    if(begin==end) return make_pair(begin,false);
+    size_t size=1+static_cast<unsigned char>(*begin);
+    if(size_t(end-begin)<size) return make_pair(begin,false);
+    return make_pair(begin+size,true);
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::seconds(2));
+
+        string result;
+        vector<string> delims={"\r\n","OK\r\n"};
+        pty.write("OK\r\nvalue\r\n");
+        check(serial.readStringUntilAny(result,delims)==1,
+            "the longest delimiter must win");
+        check(result.empty(),"OK line");
+        check(serial.readStringUntilAny(result,delims)==0,"short delimiter");
+        check(result=="value","value line");
+
+        //The delimiter ending first wins, even if listed last
+        vector<string> replies={"OK\r\n","ERROR\r\n"};
+        thread writer([&pty]{
+            pty.write("+CME ERR");
+            this_thread::sleep_for(chrono::milliseconds(20));
+            pty.write("OR\r\nOK\r\n");
+        });
+        check(serial.readStringUntilAny(result,replies)==1,"ERROR reply");
+        check(result=="+CME ","ERROR reply data");
+        writer.join();
+        check(serial.readStringUntilAny(result,replies)==0,"OK reply");
+        check(result.empty(),"OK reply data");
+
+        //Length prefixed frames, the second one split in two writes
+        writer=thread([&pty]{
+            pty.write("\x03" "abc" "\x05" "de");
+            this_thread::sleep_for(chrono::milliseconds(20));
+            pty.write("fgh");
+        });
+        check(serial.readStringUntilMatch(result,frame)=="\x03" "abc",
+            "first frame");
+        check(serial.readStringUntilMatch(result,frame)=="\x05" "defgh",
+            "split frame");
+        writer.join();
+
+        //An incomplete frame times out
+        serial.setTimeout(boost::posix_time::milliseconds(100));
+        pty.write("\x04" "ab");
+        bool timedOut=false;
+        try {
+            serial.readStringUntilMatch(result,frame);
+        } catch(timeout_exception&)
+        {
+            timedOut=true;
+        }
+        check(timedOut,"incomplete frame did not time out");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/*
+ * readAtLeast() and readSome() test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal written by this program.
+ * Checks that the reads wait for the minimum size across separate writes,
+ * and that a timeout returns the data received so far instead of throwing.
+ * Built with the backend selected by TIMEOUTSERIAL_POLL. Linux only, as it
+ * uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::seconds(2));
+        char data[16];
+
+        //The minimum size arrives in two writes
+        thread writer([&pty]{
+            pty.write("ab");
+            this_thread::sleep_for(chrono::milliseconds(20));
+            pty.write("cdef");
+        });
+        size_t n=serial.readAtLeast(data,4,sizeof(data));
+        writer.join();
+        check(n>=4 && n<=6,"readAtLeast() returned "+to_string(n)+" bytes");
+        if(n<6) n+=serial.readAtLeast(data+n,6-n,6-n);
+        check(string(data,n)=="abcdef","readAtLeast() data");
+
+        pty.write("hello");
+        n=serial.readSome(data,sizeof(data));
+        if(n<5) n+=serial.readAtLeast(data+n,5-n,5-n);
+        check(string(data,n)=="hello","readSome() data");
+        pty.write("0123456789");
+        n=serial.readAtLeast(data,2,4);
+        check(n>=2 && n<=4,"readAtLeast() exceeded maxSize");
+        string rest=serial.readString(10-n);
+        check(string(data,n)+rest=="0123456789","data after maxSize");
+
+        //A timeout returns what arrived so far
+        serial.setTimeout(boost::posix_time::milliseconds(100));
+        pty.write("xy");
+        auto start=chrono::steady_clock::now();
+        n=serial.readAtLeast(data,4,sizeof(data));
+        check(chrono::steady_clock::now()-start>=chrono::milliseconds(90),
+            "readAtLeast() returned before the timeout");
+        check(string(data,n)=="xy","readAtLeast() after a timeout");
+        check(serial.readSome(data,sizeof(data))==0,
+            "readSome() without data did not return 0");
+        pty.write("z");
+        check(serial.readSome(data,sizeof(data))==1 && data[0]=='z',
+            "readSome() after a timeout");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
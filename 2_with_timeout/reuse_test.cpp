@@ -0,0 +1,87 @@
+/*
+ * Buffer reusing read test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal written by this program.
+ * Checks that the read overloads taking a caller provided vector, string or
+ * buffer return the same data as the allocating ones, that they reuse the
+ * capacity they are given, and that a line too long for a char buffer is left
+ * for the next read. Built with the backend selected by TIMEOUTSERIAL_POLL.
+ * Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::seconds(2));
+
+        vector<char> data;
+        data.reserve(64);
+        const char *storage=data.data();
+        pty.write("abcdefgh");
+        serial.read(data,4);
+        check(string(data.begin(),data.end())=="abcd","read(vector&,size)");
+        serial.read(data,4);
+        check(string(data.begin(),data.end())=="efgh","second read(vector&,size)");
+        check(data.data()==storage,"read(vector&,size) reallocated");
+
+        string result;
+        result.reserve(64);
+        pty.write("0123456789");
+        check(serial.readString(result,4)=="0123","readString(string&,size)");
+        check(result=="0123","readString(string&,size) result");
+        check(serial.readString(result,6)=="456789","second readString()");
+
+        pty.write("line one\nline two\n");
+        check(serial.readStringUntil(result,"\n")=="line one",
+            "readStringUntil(string&,delim)");
+        check(result=="line one","readStringUntil(string&,delim) result");
+        check(serial.readStringUntil(result,"\n")=="line two",
+            "second readStringUntil(string&,delim)");
+
+        //A line not fitting in the buffer is not consumed
+        char small[8], large[32];
+        pty.write("too long for it\nok\n");
+        bool tooLong=false;
+        try {
+            serial.readStringUntil(small,sizeof(small),"\n");
+        } catch(length_error&)
+        {
+            tooLong=true;
+        }
+        check(tooLong,"readStringUntil(char*,...) accepted a long line");
+        check(serial.readStringUntil(large,sizeof(large),"\n")=="too long for it",
+            "long line lost after length_error");
+        check(serial.readStringUntil(small,sizeof(small),"\n")=="ok",
+            "readStringUntil(char*,size,delim)");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
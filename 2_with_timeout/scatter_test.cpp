@@ -0,0 +1,81 @@
+/*
+ * Scatter read test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal written by this program.
+ * Checks that read() fills the buffers in order across separate writes,
+ * including data already buffered by a previous readStringUntil(), and that
+ * it times out if not all the data arrives. Built with the backend selected
+ * by TIMEOUTSERIAL_POLL. Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::seconds(2));
+        char header[4], payload[8];
+        vector<boost::asio::mutable_buffer> buffers={
+            boost::asio::buffer(header),boost::asio::buffer(payload)};
+
+        thread writer([&pty]{
+            pty.write("HE");
+            this_thread::sleep_for(chrono::milliseconds(20));
+            pty.write("ADpay");
+            this_thread::sleep_for(chrono::milliseconds(20));
+            pty.write("load1");
+        });
+        serial.read(buffers);
+        writer.join();
+        check(string(header,4)=="HEAD","header");
+        check(string(payload,8)=="payload1","payload");
+
+        //Data buffered by a line read comes first
+        pty.write("line\nhdr1payload2");
+        check(serial.readStringUntil("\n")=="line","line");
+        serial.read(buffers);
+        check(string(header,4)=="hdr1","buffered header");
+        check(string(payload,8)=="payload2","buffered payload");
+
+        //Not all data arrives
+        serial.setTimeout(boost::posix_time::milliseconds(100));
+        pty.write("hdr2pay");
+        bool timedOut=false;
+        try {
+            serial.read(buffers);
+        } catch(timeout_exception&)
+        {
+            timedOut=true;
+        }
+        check(timedOut,"incomplete scatter read did not time out");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+/*
+ * Timeout test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal driven by this program.
+ * Checks that reads time out when no data arrives, that the port keeps
+ * working after a timeout, and that a line longer than the read buffer
+ * fails with no_buffer_space instead of blocking. Built with the backend
+ * selected by TIMEOUTSERIAL_POLL. Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::milliseconds(100));
+
+        //Nothing is sent, the read must time out
+        char c;
+        auto start=chrono::steady_clock::now();
+        bool timedOut=false;
+        try {
+            serial.read(&c,1);
+        } catch(timeout_exception&)
+        {
+            timedOut=true;
+        }
+        auto waited=chrono::steady_clock::now()-start;
+        check(timedOut,"read() did not time out");
+        check(waited>=chrono::milliseconds(90),"read() timed out too early");
+        check(waited<chrono::seconds(2),"read() timed out too late");
+
+        timedOut=false;
+        try {
+            serial.readStringUntil("\n");
+        } catch(timeout_exception&)
+        {
+            timedOut=true;
+        }
+        check(timedOut,"readStringUntil() did not time out");
+
+        //The port still works after a timeout
+        serial.writeString("hello");
+        check(pty.read(5,chrono::seconds(2))=="hello","write after a timeout");
+        pty.write("x");
+        serial.read(&c,1);
+        check(c=='x',"read after a timeout");
+        pty.write("first\r\nsecond\r\n");
+        check(serial.readStringUntil("\r\n")=="first","first line");
+        check(serial.readStringUntil("\r\n")=="second","second line");
+
+        //A line that does not fit in the read buffer
+        thread writer([&pty]{
+            pty.write(string(TimeoutSerial::readBufferMaxSize+1024,'a'));
+        });
+        bool full=false;
+        try {
+            serial.setTimeout(boost::posix_time::seconds(5));
+            serial.readStringUntil("\n");
+        } catch(timeout_exception&)
+        {
+            //Leaves full false
+        } catch(boost::system::system_error& e)
+        {
+            full=e.code()==boost::asio::error::no_buffer_space;
+        }
+        check(full,"overlong line not reported as no_buffer_space");
+        writer.join();
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*
+ * Pipelined transaction test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal where a thread of this
+ * program plays a device that answers each request line after a short delay.
+ * Checks that transact() matches the responses to the requests, respects
+ * maxInFlight, and stops the batch at the first timeout. Built with the
+ * backend selected by TIMEOUTSERIAL_POLL. Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * The device, answers "frame" with a length prefixed frame, does not answer
+ * requests starting with "drop", and answers any other request with
+ * "re:<request>\n"
+ */
+class Device
+{
+public:
+    explicit Device(PseudoTerminal& pty): pty(pty), quit(false),
+            maxPending(0), t(&Device::run,this) {}
+
+    /**
+     * Stop the device
+     * \return the requests received, in order
+     */
+    vector<string> stop()
+    {
+        quit=true;
+        t.join();
+        return requests;
+    }
+
+    /**
+     * \return the largest number of requests received in a single read
+     */
+    size_t getMaxPending() const { return maxPending; }
+
+private:
+    void run()
+    {
+        string pending;
+        while(!quit)
+        {
+            pending+=pty.read(4096,chrono::milliseconds(20));
+            size_t lines=count(pending.begin(),pending.end(),'\n');
+            maxPending=max<size_t>(maxPending,lines);
+            if(lines>0) this_thread::sleep_for(chrono::milliseconds(10));
+            size_t pos;
+            while((pos=pending.find('\n'))!=string::npos)
+            {
+                string request=pending.substr(0,pos);
+                pending.erase(0,pos+1);
+                requests.push_back(request);
+                if(request=="frame") pty.write("\x02" "hi");
+                else if(request.compare(0,4,"drop")!=0)
+                    pty.write("re:"+request+"\n");
+            }
+        }
+    }
+
+    PseudoTerminal& pty;
+    atomic<bool> quit;
+    atomic<size_t> maxPending;
+    vector<string> requests;
+    thread t;
+};
+
+/**
+ * Match a frame made of a length byte followed by that many bytes
+ */
+static pair<const char*,bool> frame(const char *begin, const char *end)
+{
+    if(begin==end) return make_pair(begin,false);
+    size_t size=1+static_cast<unsigned char>(*begin);
+    if(size_t(end-begin)<size) return make_pair(begin,false);
+    return make_pair(begin+size,true);
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::milliseconds(300));
+        Device device(pty);
+
+        vector<TimeoutSerial::Transaction> batch;
+        for(int i=0;i<6;i++)
+            batch.push_back(TimeoutSerial::Transaction("cmd"+to_string(i)+"\n"));
+        batch.push_back(TimeoutSerial::Transaction("frame\n",frame));
+        serial.transact(batch);
+        for(int i=0;i<6;i++)
+        {
+            check(batch[i].timedOut==false,"transaction timed out");
+            check(batch[i].response=="re:cmd"+to_string(i),"wrong response");
+        }
+        check(batch[6].timedOut==false,"frame transaction timed out");
+        check(batch[6].response=="\x02" "hi","wrong frame response");
+        check(device.getMaxPending()>1,"requests were not pipelined");
+
+        device.stop();
+        Device limited(pty);
+        serial.transact(batch,2);
+        for(int i=0;i<6;i++)
+            check(batch[i].response=="re:cmd"+to_string(i),
+                "wrong response with maxInFlight");
+        check(limited.getMaxPending()<=2,"more than maxInFlight requests sent");
+        limited.stop();
+
+        //The batch stops at the first timeout
+        Device ignoring(pty);
+        batch.clear();
+        batch.push_back(TimeoutSerial::Transaction("one\n"));
+        batch.push_back(TimeoutSerial::Transaction("drop\n"));
+        batch.push_back(TimeoutSerial::Transaction("two\n"));
+        serial.transact(batch,1);
+        vector<string> requests=ignoring.stop();
+        check(batch[0].timedOut==false && batch[0].response=="re:one",
+            "response before the timeout");
+        check(batch[1].timedOut,"dropped request did not time out");
+        check(batch[2].timedOut,"request after a timeout not marked");
+        check(find(requests.begin(),requests.end(),"two")==requests.end(),
+            "request after a timeout was sent");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+/*
+ * Write timeout test for TimeoutSerial.
+ * The other end of the port is a pseudo terminal that this program leaves
+ * undrained, so that writes block once its buffer is full. Checks that
+ * writeSome() returns after the timeout with the number of bytes that went
+ * out, that write() throws timeout_exception, and that the port keeps
+ * working once the other end reads again. Built with the backend selected
+ * by TIMEOUTSERIAL_POLL. Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+#include "TimeoutSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+int main()
+{
+    try {
+        PseudoTerminal pty;
+        TimeoutSerial serial(pty.name(),115200);
+        serial.setTimeout(boost::posix_time::milliseconds(200));
+
+        //Far more than the pty can buffer
+        string data;
+        for(int i=0;data.size()<1<<20;i++) data+=to_string(i)+",";
+        auto start=chrono::steady_clock::now();
+        size_t written=serial.writeSome(data.data(),data.size());
+        auto waited=chrono::steady_clock::now()-start;
+        check(written>0 && written<data.size(),"writeSome() did not time out");
+        check(waited>=chrono::milliseconds(180),"writeSome() returned early");
+        check(waited<chrono::seconds(5),"writeSome() returned late");
+        check(pty.read(written,chrono::seconds(2))==data.substr(0,written),
+            "writeSome() returned a wrong count");
+        check(pty.read(1,chrono::milliseconds(100)).empty(),
+            "writeSome() wrote more than it returned");
+
+        bool timedOut=false;
+        try {
+            serial.write(data.data(),data.size());
+        } catch(timeout_exception&)
+        {
+            timedOut=true;
+        }
+        check(timedOut,"write() did not time out");
+        while(pty.read(65536,chrono::milliseconds(100)).empty()==false) ;
+
+        //The port works again once the other end reads
+        serial.writeString("ok");
+        check(pty.read(2,chrono::seconds(2))=="ok","write after a timeout");
+        pty.write("in");
+        check(serial.readString(2)=="in","read after a write timeout");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -9,15 +9,57 @@
 #define	ASYNCSERIAL_H
 
 #include <vector>
+#include <string>
 #include <memory>
 #include <functional>
+#include <chrono>
+#include <cstdint>
 #include <boost/asio.hpp>
 #include <boost/utility.hpp>
 
+#ifdef __linux__
+/// The epoll and io_uring backends are available, see setBackend()
+#define ASYNCSERIAL_NATIVE_BACKENDS
+#endif //__linux__
+
 /**
  * Used internally (pimpl)
  */
 class AsyncSerialImpl;
+class AsyncSerialServiceImpl;
+
+/**
+ * Worker threads shared by many AsyncSerial ports. By default each port
+ * has its own background thread, which does not scale to hundreds of ports.
+ * Ports constructed with an AsyncSerialService are instead served by its
+ * threads, the handlers of each port are still run one at a time.
+ * All ports using it must be closed before it is destroyed.
+ * On Mac OS X ports still have their own thread.
+ */
+class AsyncSerialService: private boost::noncopyable
+{
+public:
+    /**
+     * Constructor, starts the worker threads
+     * \param threads number of worker threads, 0 for one per CPU
+     */
+    explicit AsyncSerialService(unsigned int threads=1);
+
+    /**
+     * \return the number of worker threads
+     */
+    unsigned int threadCount() const;
+
+    /**
+     * Destructor, stops the worker threads
+     */
+    ~AsyncSerialService();
+
+private:
+    std::shared_ptr<AsyncSerialServiceImpl> pimpl;
+
+    friend class AsyncSerial;
+};
 
 /**
  * Asyncronous serial class.
@@ -26,8 +68,115 @@ class AsyncSerialImpl;
 class AsyncSerial: private boost::noncopyable
 {
 public:
+    /**
+     * What write() does when a message does not fit in the write queue
+     */
+    enum QueueFullPolicy
+    {
+        Block,     ///< Wait until enough queued data has been written
+        Fail,      ///< Throw boost::system::system_error, nothing is queued
+        /// Discard the oldest queued data not yet being written, up to
+        /// highWater bytes can be waiting in addition to those being written
+        DropOldest
+    };
+
+    /**
+     * How reads and writes are done in background
+     */
+    enum Backend
+    {
+        AsioBackend, ///< Boost asio, the default
+        /// Linux only, each port has a thread waiting on epoll that calls
+        /// the read callback as soon as data arrives. Data is written
+        /// directly from the thread calling write() if the port can take it
+        /// and no write queue limit is set, otherwise it is queued and
+        /// written from the epoll thread. The thread is per port even if
+        /// the port was constructed with an AsyncSerialService
+        EpollBackend,
+        /// Linux only, like EpollBackend but reads and writes are submitted
+        /// through io_uring, with registered read buffers if the locked
+        /// memory limit allows. A read and a batch of writes are submitted
+        /// and waited for with a single system call. Falls back to
+        /// EpollBackend if io_uring is not available
+        UringBackend
+    };
+
+    /**
+     * Scheduling policy of the threads of a port, see setThreadScheduling()
+     */
+    enum SchedulingPolicy
+    {
+        DefaultScheduling, ///< Inherited from the thread calling open()
+        FifoScheduling,    ///< Real time, SCHED_FIFO
+        RoundRobinScheduling ///< Real time, SCHED_RR
+    };
+
+    /**
+     * Statistics of a port, returned by getStats().
+     * Just wrapper class, no encapsulation provided
+     */
+    class Stats
+    {
+    public:
+        Stats();
+
+        /// Number of buckets of the histograms. Bucket i counts the values
+        /// from 2^i to 2^(i+1)-1, bucket 0 counts 0 as well, and the last
+        /// bucket also counts all larger values
+        static const unsigned int histogramSize=32;
+
+        uint64_t bytesReceived; ///< Bytes read
+        uint64_t chunksReceived; ///< Reads that returned data
+        uint64_t bytesSent; ///< Bytes written
+        uint64_t chunksSent; ///< Writes, each of many queued messages
+        uint64_t readSizes[histogramSize]; ///< Histogram of bytes per read
+        /// Histogram of the duration of the read callback, in nanoseconds
+        uint64_t callbackTimes[histogramSize];
+        size_t writeQueueSize; ///< Bytes queued or being written now
+        size_t writeQueuePeak; ///< Max of writeQueueSize so far
+        uint64_t errors; ///< Times the port went in error status
+        uint64_t reopens; ///< Times the port was opened after the first
+        /// True if the driver reports the counters below, Linux only
+        bool driverCounters;
+        uint64_t overruns; ///< Bytes lost because the UART was not read in time
+        uint64_t bufferOverruns; ///< Bytes lost because the tty buffer was full
+        uint64_t frameErrors; ///< Framing errors
+        uint64_t parityErrors; ///< Parity errors
+        uint64_t breaks; ///< Breaks received
+    };
+
+    /**
+     * Arrival information of a chunk of received data, passed to the
+     * timestamped read callback.
+     * Just wrapper class, no encapsulation provided
+     */
+    class ReadInfo
+    {
+    public:
+        ReadInfo(): sequence(0), offset(0), full(false) {}
+
+        /// When the read returned, before the callback is dispatched to.
+        /// CLOCK_MONOTONIC on Linux
+        std::chrono::steady_clock::time_point monotonic;
+        /// The same instant by the wall clock, CLOCK_REALTIME on Linux.
+        /// Only taken if requested, otherwise the epoch
+        std::chrono::system_clock::time_point realtime;
+        uint64_t sequence; ///< Chunks received before this one since open()
+        uint64_t offset; ///< Bytes received before this one since open()
+        /// True if the chunk filled the read buffer, so more data was likely
+        /// waiting, and part of it arrived earlier than the timestamp says
+        bool full;
+    };
+
     AsyncSerial();
 
+    /**
+     * Constructor. The port, once opened, is served by the threads of
+     * service instead of having its own background thread.
+     * \param service worker threads, must outlive this object
+     */
+    explicit AsyncSerial(AsyncSerialService& service);
+
     /**
      * Constructor. Creates and opens a serial device.
      * \param devname serial device name, example "/dev/ttyS0" or "COM1"
@@ -86,6 +235,14 @@ public:
      */
     bool errorStatus() const;
 
+    /**
+     * On Linux and Mac OS X open() accepts any integer baud rate, not just
+     * the standard ones, as long as the driver supports it
+     * \return the baud rate applied by the last open(), as reported by the
+     * driver, that may have rounded it to what the hardware can generate
+     */
+    unsigned int getBaudRate() const;
+
     /**
      * Close the serial device
      * \throws boost::system::system_error if any error
@@ -113,14 +270,254 @@ public:
     */
     void writeString(const std::string& s);
 
+    /**
+     * Write data asynchronously. Returns immediately.
+     * The vector is moved into the write queue instead of being copied.
+     * \param data to be sent through the serial device
+     */
+    void write(std::vector<char>&& data);
+
+    /**
+     * Write data asynchronously. Returns immediately.
+     * The buffer is not copied, a reference to it is kept until it has been
+     * sent, so it must not be modified in the meantime.
+     * \param data to be sent through the serial device
+     */
+    void write(const std::shared_ptr<const std::vector<char>>& data);
+
+    /**
+     * Write a string asynchronously. Returns immediately.
+     * The string is moved into the write queue instead of being copied.
+     * \param s string to send
+     */
+    void writeString(std::string&& s);
+
+    /**
+     * Write a string asynchronously. Returns immediately.
+     * The string is not copied, a reference to it is kept until it has been
+     * sent, so it must not be modified in the meantime.
+     * \param s string to send
+     */
+    void writeString(const std::shared_ptr<const std::string>& s);
+
+    /**
+     * Write data asynchronously if it fits in the write queue, regardless
+     * of the QueueFullPolicy. Never blocks.
+     * \param data array of char to be sent through the serial device
+     * \param size array size
+     * \return false if the write queue is full, and nothing was queued
+     */
+    bool tryWrite(const char *data, size_t size);
+
+    /**
+     * Write data asynchronously if it fits in the write queue, regardless
+     * of the QueueFullPolicy. Never blocks.
+     * \param data to be sent through the serial device, moved from only if
+     * the function succeeds
+     * \return false if the write queue is full, and nothing was queued
+     */
+    bool tryWrite(std::vector<char>&& data);
+
+    /**
+     * Write a string asynchronously if it fits in the write queue,
+     * regardless of the QueueFullPolicy. Never blocks.
+     * \param s string to send
+     * \return false if the write queue is full, and nothing was queued
+     */
+    bool tryWriteString(const std::string& s);
+
+    /**
+     * Bound the data queued for writing, by default it is unbounded.
+     * A message larger than highWater is accepted only if the queue is
+     * empty. If the port is closed, or when called from the read callback,
+     * write() does not block even with the Block policy.
+     * \param highWater max number of bytes queued or being written, 0 to
+     * remove the limit
+     * \param lowWater the low watermark callback is called when the queue
+     * goes back to this size or less after exceeding highWater
+     * \param policy what write() does when a message does not fit
+     * \throws std::invalid_argument if lowWater is greater than highWater
+     */
+    void setWriteQueueLimit(size_t highWater, size_t lowWater,
+        QueueFullPolicy policy=Block);
+
+    /**
+     * Set callbacks called from the same thread of the read callback when
+     * the write queue exceeds the high watermark, and when it then goes back
+     * to the low watermark, so that producers can throttle themselves.
+     * Only called if a limit is set with setWriteQueueLimit()
+     * \param high high watermark callback
+     * \param low low watermark callback
+     */
+    void setWriteQueueCallbacks(const std::function<void ()>& high,
+        const std::function<void ()>& low);
+
+    /**
+     * \return the number of bytes queued or being written
+     */
+    size_t writeQueueSize() const;
+
+    /**
+     * Set the size of the buffer data is read into, that is the max number
+     * of bytes passed to the read callback at once. Larger buffers mean less
+     * callbacks at high baud rates, smaller ones save memory on slow ports.
+     * Can be called before open(), otherwise takes effect from the next read.
+     * \param size read buffer size, default is readBufferSize
+     * \param maxSize if greater than size, enables the adaptive mode: the
+     * buffer doubles up to maxSize while reads keep filling it, and halves
+     * down to size while reads use only a small fraction of it
+     * \throws std::invalid_argument if size is 0
+     */
+    void setReadBufferSize(size_t size, size_t maxSize=0);
+
+    /**
+     * \return the current read buffer size
+     */
+    size_t getReadBufferSize() const;
+
+    /**
+     * Set how many buffers are used for reading. With two or more, the next
+     * read is started before the read callback is called on the data just
+     * read, so the port keeps being drained while the callback runs.
+     * Takes effect from the next open(), default is two buffers.
+     * \param count number of read buffers, one disables overlapping
+     * \param consumerThread if true the read callback is called from a
+     * separate thread, so that the thread doing I/O never waits for it.
+     * Up to count-1 buffers can be waiting for the callback, if they are all
+     * busy reading pauses until the callback returns.
+     * \throws std::invalid_argument if count is 0
+     */
+    void setReadBuffers(unsigned int count, bool consumerThread=false);
+
+    /**
+     * Select how reads and writes are done, takes effect from the next
+     * open(). Default is AsioBackend.
+     * \param backend backend to use
+     * \throws std::invalid_argument if the backend is not available in
+     * this build
+     */
+    void setBackend(Backend backend);
+
+    /**
+     * \return the backend in use if the port is open, which may differ from
+     * the selected one if it was not available, otherwise the selected one
+     */
+    Backend getBackend() const;
+
+    /**
+     * Busy polling, for the lowest latency at the cost of CPU time.
+     * After each event the background thread keeps checking for new data
+     * without sleeping, for up to the given time, so that it does not pay
+     * for a wakeup and a context switch when data arrives.
+     * Takes effect the next time the port is opened. With the asio backend
+     * it applies only to ports having their own background thread, not to
+     * ports constructed with an AsyncSerialService.
+     * \param t how long to poll before sleeping, zero (the default) to
+     * disable, boost::posix_time::pos_infin to never sleep, for a
+     * background thread having a dedicated CPU core
+     * \throws std::invalid_argument if t is negative or not a valid time, or
+     * busy polling is not available on this platform
+     */
+    void setBusyPoll(const boost::posix_time::time_duration& t);
+
+    /**
+     * Restrict the threads of the port to a set of CPUs, to keep them away
+     * from cores busy with other work or with interrupts.
+     * The thread options apply to the background thread, that runs the read
+     * callback, and in consumer thread mode to the consumer thread. Like
+     * busy polling, they don't apply to the threads of an
+     * AsyncSerialService with the asio backend.
+     * Options that can't be applied, for example for lack of privileges, are
+     * skipped and reported by threadOptionsError().
+     * Takes effect the next time the port is opened.
+     * \param cpus CPU numbers, empty (the default) for any CPU
+     */
+    void setThreadAffinity(const std::vector<unsigned int>& cpus);
+
+    /**
+     * Run the threads of the port with a real time policy, so that other
+     * processes can't delay the read callback. See setThreadAffinity() for
+     * the threads the option applies to.
+     * Takes effect the next time the port is opened.
+     * \param policy scheduling policy, default is DefaultScheduling
+     * \param priority real time priority, 1 to 99 on Linux
+     * \throws std::invalid_argument if the priority is not valid for the
+     * policy
+     */
+    void setThreadScheduling(SchedulingPolicy policy, int priority=0);
+
+    /**
+     * Prefault and lock in memory the part of the stack the threads of the
+     * port use, so that they take no page faults, like mlockall() does for
+     * the whole process. See setThreadAffinity() for the threads the option
+     * applies to.
+     * Takes effect the next time the port is opened.
+     * \param size bytes of stack to lock, 0 (the default) to disable. Must
+     * be less than the stack size of the threads
+     */
+    void setThreadStackLock(size_t size);
+
+    /**
+     * \return a description of the thread options that could not be applied
+     * the last time the port was opened, empty if all were applied
+     */
+    std::string threadOptionsError() const;
+
+    /**
+     * \return the statistics of the port since it was constructed or
+     * resetStats() was called. Collecting them takes some relaxed atomic
+     * operations per read and write, and two clock readings per read
+     * callback. The driver counters are read from the driver by this call,
+     * and are not affected by resetStats()
+     */
+    Stats getStats() const;
+
+    /**
+     * Zero the statistics. The write queue peak restarts from the current
+     * queue size
+     */
+    void resetStats();
+
     virtual ~AsyncSerial()=0;
 
     /**
-     * Read buffer maximum size
+     * Default read buffer size, see setReadBufferSize()
      */
     static const int readBufferSize=512;
 private:
 
+    /**
+     * Open the port with the asio backend and start reading, the parameters
+     * are the ones of open()
+     */
+    void openAsio(const std::string& devname, unsigned int baud_rate,
+        const boost::asio::serial_port_base::parity& opt_parity,
+        const boost::asio::serial_port_base::character_size& opt_csize,
+        const boost::asio::serial_port_base::flow_control& opt_flow,
+        const boost::asio::serial_port_base::stop_bits& opt_stop);
+
+    /**
+     * Close a port opened by openAsio(), waiting for its handlers to end
+     */
+    void closeAsio();
+
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    /**
+     * Open the port with the epoll or io_uring backend and start the
+     * background thread, the parameters are the ones of open()
+     */
+    void openNative(const std::string& devname, unsigned int baud_rate,
+        const boost::asio::serial_port_base::parity& opt_parity,
+        const boost::asio::serial_port_base::character_size& opt_csize,
+        const boost::asio::serial_port_base::flow_control& opt_flow,
+        const boost::asio::serial_port_base::stop_bits& opt_stop);
+
+    /**
+     * Close a port opened by openNative(), stopping the background thread
+     */
+    void closeNative();
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+
     /**
      * Callback called to start an asynchronous read operation.
      * This callback is called by the io_service in the spawned thread.
@@ -134,6 +531,12 @@ private:
     void readEnd(const boost::system::error_code& error,
         size_t bytes_transferred);
 
+    /**
+     * Consumer thread main loop, calls the read callback on the buffers
+     * filled by the io_service thread
+     */
+    void consumeReads();
+
     /**
      * Callback called to start an asynchronous write operation.
      * If it is already in progress, does nothing.
@@ -153,6 +556,59 @@ private:
      */
     void doClose();
 
+    /**
+     * Schedule doRead(), or with the epoll backend a read from the epoll
+     * thread
+     */
+    void postRead();
+
+    /**
+     * Schedule doWrite(), or with the epoll backend write immediately if
+     * possible
+     */
+    void postWrite();
+
+    /**
+     * Schedule checkWriteQueue()
+     */
+    void postCheck();
+
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    /**
+     * Main loop of the epoll backend, runs in the background thread
+     */
+    void runEpoll();
+
+    /**
+     * Main loop of the io_uring backend, runs in the background thread
+     */
+    void runUring();
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+
+    /**
+     * Account for a message that is about to be queued, enforcing the
+     * write queue limit
+     * \param size message size
+     * \param failFast if true never wait, just fail if the message does
+     * not fit, regardless of the policy
+     * \return false if the message does not fit
+     */
+    bool admitWrite(size_t size, bool failFast);
+
+    /**
+     * Called after a message has been queued, posts the callbacks needed
+     * to handle it
+     * \param post true if doWrite() has to be posted
+     */
+    void writeQueued(bool post);
+
+    /**
+     * Callback to enforce the DropOldest policy and call the watermark
+     * callbacks when the write queue is over the limit.
+     * This callback is called by the io_service in the spawned thread.
+     */
+    void checkWriteQueue();
+
     std::shared_ptr<AsyncSerialImpl> pimpl;
 
 protected:
@@ -168,6 +624,15 @@ protected:
      */
     void setReadCallback(const std::function<void (const char*, size_t)>& callback);
 
+    /**
+     * To allow derived classes to set a read callback that also receives
+     * the arrival information of the data. Replaces the read callback
+     * \param callback the callback
+     * \param realtime if true, the ReadInfo also has the wall clock time
+     */
+    void setTimestampedReadCallback(const std::function<void (const char*,
+        size_t, const ReadInfo&)>& callback, bool realtime=false);
+
     /**
      * To unregister the read callback in the derived class destructor so it
      * does not get called after the derived class destructor but before the
@@ -187,6 +652,13 @@ class CallbackAsyncSerial: public AsyncSerial
 public:
     CallbackAsyncSerial();
 
+    /**
+     * Constructor. The port, once opened, is served by the threads of
+     * service instead of having its own background thread.
+     * \param service worker threads, must outlive this object
+     */
+    explicit CallbackAsyncSerial(AsyncSerialService& service);
+
     /**
     * Opens a serial device.
     * \param devname serial device name, example "/dev/ttyS0" or "COM1"
@@ -219,6 +691,17 @@ public:
      */
     void setCallback(const std::function<void (const char*, size_t)>& callback);
 
+    /**
+     * Set a read callback that also receives when the data arrived, as
+     * taken by the background thread as soon as the read returned, before
+     * the callback is dispatched. Replaces the callback set with
+     * setCallback(), and vice versa.
+     * \param callback the receive callback
+     * \param realtime if true, the wall clock time is taken too
+     */
+    void setTimestampedCallback(const std::function<void (const char*, size_t,
+        const ReadInfo&)>& callback, bool realtime=false);
+
     /**
      * Removes the callback. Any data received after this function call will
      * be lost.
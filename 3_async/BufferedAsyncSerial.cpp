@@ -23,6 +23,12 @@ BufferedAsyncSerial::BufferedAsyncSerial(): AsyncSerial()
     setReadCallback(std::bind(&BufferedAsyncSerial::readCallback, this, _1, _2));
 }
 
+BufferedAsyncSerial::BufferedAsyncSerial(AsyncSerialService& service)
+        : AsyncSerial(service)
+{
+    setReadCallback(std::bind(&BufferedAsyncSerial::readCallback, this, _1, _2));
+}
+
 BufferedAsyncSerial::BufferedAsyncSerial(const std::string& devname,
         unsigned int baud_rate,
         asio::serial_port_base::parity opt_parity,
@@ -16,6 +16,13 @@ class BufferedAsyncSerial: public AsyncSerial
 public:
     BufferedAsyncSerial();
 
+    /**
+     * Constructor. The port, once opened, is served by the threads of
+     * service instead of having its own background thread.
+     * \param service worker threads, must outlive this object
+     */
+    explicit BufferedAsyncSerial(AsyncSerialService& service);
+
     /**
     * Opens a serial device.
     * \param devname serial device name, example "/dev/ttyS0" or "COM1"
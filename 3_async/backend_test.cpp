@@ -0,0 +1,116 @@
+/*
+ * Backend test for AsyncSerial.
+ * The other end of the port is a pseudo terminal driven by this program.
+ * Checks that the selected backend is the one in use, echoes data through
+ * it, including a write far larger than the pseudo terminal can buffer, so
+ * that it completes in many partial writes, and checks that a hangup puts
+ * the port in error status and that it can then be reopened. The backend is
+ * given as argument, "asio", "epoll" or "uring".
+ * Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+/**
+ * \return size bytes of test data
+ */
+static string pattern(size_t size)
+{
+    string result;
+    for(size_t i=0;i<size;i++) result+=static_cast<char>(i%251);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        unique_ptr<PseudoTerminal> pty(new PseudoTerminal);
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        const AsyncSerial::Backend selected=serial.getBackend();
+        serial.setCallback([&serial](const char *data, size_t size){
+            serial.write(data,size); //Echo
+        });
+        serial.open(pty->name(),115200);
+        //io_uring falls back to epoll where not available
+        AsyncSerial::Backend active=serial.getBackend();
+        check(active==selected || (selected==AsyncSerial::UringBackend &&
+            active==AsyncSerial::EpollBackend),"wrong backend in use");
+        if(active!=selected) cout<<"io_uring not available"<<endl;
+
+        pty->write("echo");
+        check(pty->read(4,chrono::seconds(2))=="echo","echo");
+
+        //Partial writes, the pty is read only after the write is queued
+        string data=pattern(1<<20);
+        serial.writeString(data);
+        this_thread::sleep_for(chrono::milliseconds(50));
+        check(serial.writeQueueSize()>0,"large write completed at once");
+        check(pty->read(data.size(),chrono::seconds(10))==data,
+            "large write lost or corrupted");
+
+        //Hangup
+        pty->closeMaster();
+        auto deadline=chrono::steady_clock::now()+chrono::seconds(2);
+        while(serial.errorStatus()==false &&
+              chrono::steady_clock::now()<deadline)
+            this_thread::sleep_for(chrono::milliseconds(1));
+        check(serial.errorStatus(),"hangup not reported");
+        try {
+            serial.close();
+        } catch(boost::system::system_error&)
+        {
+            //close() reports the error status
+        }
+
+        //Reopen on a new pty
+        pty.reset(new PseudoTerminal);
+        serial.open(pty->name(),115200);
+        check(serial.errorStatus()==false,"error status after reopening");
+        pty->write("again");
+        check(pty->read(5,chrono::seconds(2))=="again","echo after reopening");
+        serial.close();
+        check(serial.getBackend()==selected,"selected backend changed");
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+/*
+ * Baud rate test for AsyncSerial.
+ * The read callback echoes back what it receives, the other end of the port
+ * is a pseudo terminal driven by this program. Opens the port at standard
+ * and non-standard rates, and checks that getBaudRate() reads back the
+ * requested rate, that standard rates are still visible to tcgetattr(), and
+ * that data goes through. The backend is given as argument, "asio", "epoll"
+ * or "uring". Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <termios.h>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        serial.setCallback([&serial](const char *data, size_t size){
+            serial.write(data,size); //Echo
+        });
+        const unsigned int rates[]={9600,115200,250000,1000000,12000000};
+        for(unsigned int rate : rates)
+        {
+            string name=to_string(rate);
+            serial.open(pty.name(),rate);
+            check(serial.getBaudRate()==rate,name+": wrong rate read back");
+            termios t;
+            check(tcgetattr(pty.slave(),&t)==0,name+": tcgetattr");
+            if(rate==9600) check(cfgetospeed(&t)==B9600,name+": not B9600");
+            if(rate==115200)
+                check(cfgetospeed(&t)==B115200,name+": not B115200");
+            pty.write("ping");
+            check(pty.read(4,chrono::seconds(2))=="ping",name+": echo");
+            serial.close();
+        }
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
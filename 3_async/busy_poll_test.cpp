@@ -0,0 +1,96 @@
+/*
+ * Busy polling test for AsyncSerial.
+ * The read callback echoes back what it receives, the other end of the port
+ * is a pseudo terminal driven by this program. Checks that the echo works
+ * when busy polling for a while and when never sleeping, that close()
+ * returns promptly from a spinning thread, and that invalid polling times
+ * are rejected. The backend is given as argument, "asio", "epoll" or
+ * "uring". Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        serial.setCallback([&serial](const char *data, size_t size){
+            serial.write(data,size); //Echo
+        });
+        bool invalid=false;
+        try {
+            serial.setBusyPoll(boost::posix_time::microseconds(-1));
+        } catch(invalid_argument&)
+        {
+            invalid=true;
+        }
+        check(invalid,"negative busy polling time accepted");
+
+        const boost::posix_time::time_duration modes[]={
+            boost::posix_time::microseconds(50),
+            boost::posix_time::time_duration(boost::posix_time::pos_infin),
+            boost::posix_time::microseconds(0)};
+        const char *names[]={"50us","forever","disabled"};
+        for(int i=0;i<3;i++)
+        {
+            serial.setBusyPoll(modes[i]);
+            serial.open(pty.name(),115200);
+            string name=names[i];
+            for(int j=0;j<100;j++)
+            {
+                string message="ping "+to_string(j);
+                pty.write(message);
+                if(pty.read(message.size(),chrono::seconds(2))!=message)
+                {
+                    check(false,name+": echo lost");
+                    break;
+                }
+            }
+            auto start=chrono::steady_clock::now();
+            serial.close();
+            check(chrono::steady_clock::now()-start<chrono::seconds(1),
+                name+": close() took too long");
+        }
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/*
+ * Concurrent writers test for AsyncSerial.
+ * Many threads write numbered messages to the same port, the other end of
+ * the port is a pseudo terminal read by this program. Checks that no two
+ * messages are interleaved, none is lost, and those of each thread arrive in
+ * the order they were written. The backend is given as argument, "asio",
+ * "epoll" or "uring". Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+static const int threadCount=4;
+static const int messageCount=5000;
+static const size_t messageSize=16;
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        serial.open(pty.name(),115200);
+
+        string received;
+        thread reader([&]{
+            received=pty.read(threadCount*messageCount*messageSize,
+                chrono::seconds(20));
+        });
+        vector<thread> writers;
+        for(int i=0;i<threadCount;i++)
+        {
+            writers.push_back(thread([&serial,i]{
+                for(int j=0;j<messageCount;j++)
+                {
+                    //Thread letter, sequence number, newline
+                    char message[messageSize+1];
+                    snprintf(message,sizeof(message),"%c%014d\n",'A'+i,j);
+                    switch(j%3)
+                    {
+                        case 0: serial.write(message,messageSize); break;
+                        case 1: serial.writeString(message); break;
+                        case 2: serial.write(vector<char>(message,
+                            message+messageSize)); break;
+                    }
+                }
+            }));
+        }
+        for(auto& w : writers) w.join();
+        reader.join();
+
+        check(received.size()==threadCount*messageCount*messageSize,"received "+
+            to_string(received.size())+" bytes");
+        vector<int> next(threadCount,0);
+        for(size_t i=0;i+messageSize<=received.size();i+=messageSize)
+        {
+            string message=received.substr(i,messageSize);
+            int t=message[0]-'A';
+            if(t<0 || t>=threadCount || message.back()!='\n' ||
+               message.find_first_not_of("0123456789",1)!=messageSize-1)
+            {
+                check(false,"interleaved message at offset "+to_string(i));
+                break;
+            }
+            int sequence=atoi(message.c_str()+1);
+            if(sequence!=next[t])
+            {
+                check(false,"thread "+to_string(t)+" message "+
+                    to_string(sequence)+" out of order");
+                break;
+            }
+            next[t]++;
+        }
+        check(serial.errorStatus()==false,"port in error status");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
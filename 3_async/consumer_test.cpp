@@ -0,0 +1,173 @@
+/*
+ * Read buffers and consumer thread test for AsyncSerial.
+ * The other end of the port is a pseudo terminal written by this program.
+ * A read callback that stalls now and then must still get all the data in
+ * order, with one or more read buffers and with the consumer thread. Also
+ * checks that close() returns while the consumer is stalled, and that no
+ * callback runs after it. The backend is given as argument, "asio", "epoll"
+ * or "uring". Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+/**
+ * Data received by the read callback
+ */
+class Received
+{
+public:
+    Received(): largest(0) {}
+
+    void add(const char *data, size_t size)
+    {
+        lock_guard<mutex> l(m);
+        received.append(data,size);
+        largest=max(largest,size);
+    }
+
+    /**
+     * Wait up to 5s for size bytes
+     * \return the data received so far and the largest chunk, and clear
+     * them
+     */
+    string take(size_t size, size_t& largestChunk)
+    {
+        auto deadline=chrono::steady_clock::now()+chrono::seconds(5);
+        for(;;)
+        {
+            {
+                lock_guard<mutex> l(m);
+                if(received.size()>=size ||
+                   chrono::steady_clock::now()>=deadline)
+                {
+                    string result;
+                    result.swap(received);
+                    largestChunk=largest;
+                    largest=0;
+                    return result;
+                }
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+private:
+    mutex m;
+    string received;
+    size_t largest;
+};
+
+/**
+ * \return size bytes of test data
+ */
+static string pattern(size_t size)
+{
+    string result;
+    for(size_t i=0;i<size;i++) result+=static_cast<char>(i%251);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        bool invalid=false;
+        try {
+            serial.setReadBuffers(0);
+        } catch(invalid_argument&)
+        {
+            invalid=true;
+        }
+        check(invalid,"setReadBuffers(0) accepted");
+
+        Received received;
+        int calls=0;
+        serial.setCallback([&](const char *data, size_t size){
+            received.add(data,size);
+            if(++calls%20==0) this_thread::sleep_for(chrono::milliseconds(1));
+        });
+        string data=pattern(500000);
+        const struct { unsigned int count; bool consumer; } modes[]=
+            {{1,false},{2,false},{4,true},{2,true}};
+        for(auto& mode : modes)
+        {
+            string name=to_string(mode.count)+(mode.consumer ?
+                " buffers, consumer thread" : " buffers");
+            serial.setReadBuffers(mode.count,mode.consumer);
+            serial.open(pty.name(),115200);
+            pty.write(data);
+            size_t largest;
+            check(received.take(data.size(),largest)==data,
+                "data lost or out of order with "+name);
+            serial.close();
+        }
+
+        //close() while the consumer thread is stalled in the callback
+        atomic<bool> stalled(false), closed(false), lateCall(false);
+        serial.setCallback([&](const char*, size_t){
+            if(closed) lateCall=true;
+            stalled=true;
+            this_thread::sleep_for(chrono::milliseconds(200));
+        });
+        serial.setReadBuffers(4,true);
+        serial.open(pty.name(),115200);
+        for(int i=0;i<10;i++)
+        {
+            pty.write(data.substr(0,100));
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        while(!stalled) this_thread::sleep_for(chrono::milliseconds(1));
+        auto start=chrono::steady_clock::now();
+        serial.close();
+        closed=true;
+        check(chrono::steady_clock::now()-start<chrono::seconds(2),
+            "close() waited for the stalled consumer too long");
+        this_thread::sleep_for(chrono::milliseconds(300));
+        check(lateCall==false,"read callback called after close()");
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
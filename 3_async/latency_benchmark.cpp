@@ -0,0 +1,130 @@
+/*
+ * Echo latency benchmark for AsyncSerial.
+ * The read callback writes back what it receives, the other end of the port
+ * is a pseudo terminal where this program sends a message and times how long
+ * it takes to come back. Linux only, as it uses a pseudo terminal. Arguments,
+ * in any order:
+ * - the backend, "epoll" or "uring", default is asio
+ * - busy=N to busy poll for N microseconds, "busy=forever" to never sleep
+ * - "fifo" to run the port's thread with SCHED_FIFO priority 50
+ * - hogs=N to start N threads that keep the CPUs busy meanwhile
+ * - bytes=N message size, default 32, samples=N, default 20000
+ */
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+/**
+ * \return the value of a name=value argument, or nullptr if not given
+ */
+static const char *option(int argc, char *argv[], const char *name)
+{
+    size_t len=strlen(name);
+    for(int i=1;i<argc;i++)
+        if(strncmp(argv[i],name,len)==0 && argv[i][len]=='=')
+            return argv[i]+len+1;
+    return nullptr;
+}
+
+/**
+ * \return the value of a numeric name=value argument, or def if not given
+ */
+static size_t option(int argc, char *argv[], const char *name, size_t def)
+{
+    const char *value=option(argc,argv,name);
+    return value ? strtoul(value,nullptr,10) : def;
+}
+
+/**
+ * \return the busy polling time given as busy=N microseconds or
+ * busy=forever, zero if not given
+ */
+static boost::posix_time::time_duration busyPoll(int argc, char *argv[])
+{
+    const char *value=option(argc,argv,"busy");
+    if(value==nullptr) return boost::posix_time::microseconds(0);
+    if(strcmp(value,"forever")==0)
+        return boost::posix_time::time_duration(boost::posix_time::pos_infin);
+    return boost::posix_time::microseconds(atoi(value));
+}
+
+/**
+ * \return true if the argument was given
+ */
+static bool flag(int argc, char *argv[], const char *name)
+{
+    for(int i=1;i<argc;i++) if(strcmp(argv[i],name)==0) return true;
+    return false;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t bytes=option(argc,argv,"bytes",32);
+    const size_t samples=option(argc,argv,"samples",20000);
+    const size_t hogs=option(argc,argv,"hogs",0);
+    atomic<bool> quit(false);
+    vector<thread> hogThreads;
+    for(size_t i=0;i<hogs;i++)
+        hogThreads.push_back(thread([&quit]{ while(!quit) ; }));
+
+    vector<double> rtt;
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        if(flag(argc,argv,"epoll"))
+            serial.setBackend(AsyncSerial::EpollBackend);
+        if(flag(argc,argv,"uring"))
+            serial.setBackend(AsyncSerial::UringBackend);
+        serial.setBusyPoll(busyPoll(argc,argv));
+        if(flag(argc,argv,"fifo"))
+            serial.setThreadScheduling(AsyncSerial::FifoScheduling,50);
+        serial.setCallback([&serial](const char *data, size_t size){
+            serial.write(data,size);
+        });
+        serial.open(pty.name(),115200);
+        if(serial.threadOptionsError().empty()==false)
+            cout<<"Thread options not applied: "
+                <<serial.threadOptionsError()<<endl;
+        vector<char> message(bytes,'x');
+        vector<char> echo(bytes);
+        for(size_t i=0;i<samples;i++)
+        {
+            auto start=chrono::steady_clock::now();
+            if(write(pty.master(),message.data(),bytes)!=ssize_t(bytes)) break;
+            for(size_t received=0;received<bytes;)
+            {
+                ssize_t n=read(pty.master(),echo.data(),bytes-received);
+                if(n<=0) throw runtime_error("read from the pty failed");
+                received+=n;
+            }
+            rtt.push_back(chrono::duration<double,micro>(
+                chrono::steady_clock::now()-start).count());
+        }
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        rtt.clear();
+    }
+    quit=true;
+    for(auto& h : hogThreads) h.join();
+    if(rtt.empty()) return 1;
+
+    sort(rtt.begin(),rtt.end());
+    cout<<"round trip us\tp50\tp90\tp99\tp99.9\tmax"<<endl;
+    cout<<"\t\t"<<rtt[rtt.size()/2]<<"\t"<<rtt[rtt.size()*90/100]<<"\t"
+        <<rtt[rtt.size()*99/100]<<"\t"<<rtt[rtt.size()*999/1000]<<"\t"
+        <<rtt.back()<<endl;
+}
@@ -0,0 +1,99 @@
+/*
+ * Moving and shared buffer write test for AsyncSerial.
+ * The other end of the port is a pseudo terminal read by this program.
+ * Checks that interleaved copied, moved and shared writes arrive in order,
+ * and that the port releases a shared buffer once it has been sent. The
+ * backend is given as argument, "asio", "epoll" or "uring".
+ * Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        serial.open(pty.name(),115200);
+
+        auto shared=make_shared<const vector<char>>(30000,'s');
+        auto sharedString=make_shared<const string>("shared string");
+        string expected;
+        for(int i=0;i<100;i++)
+        {
+            string copied="copied "+to_string(i);
+            serial.writeString(copied);
+            vector<char> moved(i*100+1,'m');
+            expected+=copied+string(moved.begin(),moved.end());
+            serial.write(move(moved));
+            string movedString="moved string "+to_string(i);
+            expected+=movedString;
+            serial.writeString(move(movedString));
+            if(i%10==0)
+            {
+                serial.write(shared);
+                serial.writeString(sharedString);
+                expected+=string(shared->begin(),shared->end())+*sharedString;
+            }
+        }
+        string received=pty.read(expected.size(),chrono::seconds(10));
+        check(received.size()==expected.size(),"received "+
+            to_string(received.size())+" of "+to_string(expected.size())+
+            " bytes");
+        check(received==expected,"data out of order");
+
+        //The port drops its references once the data is sent
+        auto deadline=chrono::steady_clock::now()+chrono::seconds(2);
+        while((shared.use_count()>1 || sharedString.use_count()>1) &&
+            chrono::steady_clock::now()<deadline)
+            this_thread::sleep_for(chrono::milliseconds(1));
+        check(shared.use_count()==1,"shared vector not released");
+        check(sharedString.use_count()==1,"shared string not released");
+        check(serial.errorStatus()==false,"port in error status");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
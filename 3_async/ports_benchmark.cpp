@@ -0,0 +1,152 @@
+/*
+ * Many ports benchmark for AsyncSerial.
+ * Each port echoes back what it receives from its read callback, the other
+ * end of every port is a pseudo terminal where this program sends 32 bytes
+ * every 10ms and reads back the echo. Reports threads, memory and CPU usage,
+ * and checks that no data was lost. Linux only, as it uses a pseudo terminal.
+ * Arguments, in any order:
+ * - ports=N number of ports, default 64
+ * - service=N to serve the ports with an AsyncSerialService of N threads,
+ *   by default each port has its own thread
+ * - seconds=N test duration, default 10
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+/**
+ * \return the value of a numeric name=value argument, or def if not given
+ */
+static size_t option(int argc, char *argv[], const char *name, size_t def)
+{
+    size_t len=strlen(name);
+    for(int i=1;i<argc;i++)
+        if(strncmp(argv[i],name,len)==0 && argv[i][len]=='=')
+            return strtoul(argv[i]+len+1,nullptr,10);
+    return def;
+}
+
+/**
+ * \return CPU time used by the process so far, in seconds
+ */
+static double cpuTime()
+{
+    rusage r;
+    getrusage(RUSAGE_SELF,&r);
+    return r.ru_utime.tv_sec+r.ru_stime.tv_sec+
+        (r.ru_utime.tv_usec+r.ru_stime.tv_usec)/1e6;
+}
+
+/**
+ * \return a field of /proc/self/status, such as "Threads:"
+ */
+static string status(const string& field)
+{
+    ifstream in("/proc/self/status");
+    string line;
+    while(getline(in,line))
+        if(line.compare(0,field.size(),field)==0)
+            return line.substr(line.find_first_not_of(" \t",field.size()));
+    return "?";
+}
+
+/**
+ * A port under test and the pseudo terminal at its other end
+ */
+struct Port
+{
+    unique_ptr<PseudoTerminal> pty;
+    unique_ptr<CallbackAsyncSerial> serial;
+    size_t sent,received;
+};
+
+int main(int argc, char* argv[])
+{
+    const size_t ports=option(argc,argv,"ports",64);
+    const size_t threads=option(argc,argv,"service",0);
+    const size_t seconds=option(argc,argv,"seconds",10);
+
+    //Every port takes three file descriptors
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE,&limit);
+    limit.rlim_cur=limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE,&limit);
+
+    size_t lost=0;
+    try {
+        unique_ptr<AsyncSerialService> service;
+        if(threads>0) service.reset(new AsyncSerialService(threads));
+        vector<Port> p(ports);
+        for(auto& port : p)
+        {
+            port.pty.reset(new PseudoTerminal);
+            int master=port.pty->master();
+            fcntl(master,F_SETFL,fcntl(master,F_GETFL) | O_NONBLOCK);
+            port.sent=port.received=0;
+            if(service) port.serial.reset(new CallbackAsyncSerial(*service));
+            else port.serial.reset(new CallbackAsyncSerial);
+            CallbackAsyncSerial *serial=port.serial.get();
+            serial->setCallback([serial](const char *data, size_t size){
+                serial->write(data,size);
+            });
+            serial->open(port.pty->name(),115200);
+        }
+
+        char message[32];
+        memset(message,'x',sizeof(message));
+        char echo[4096];
+        double cpu=cpuTime();
+        auto start=chrono::steady_clock::now();
+        auto end=start+chrono::seconds(seconds);
+        for(auto next=start;next<end;next+=chrono::milliseconds(10))
+        {
+            this_thread::sleep_until(next);
+            for(auto& port : p)
+            {
+                ssize_t n;
+                while((n=read(port.pty->master(),echo,sizeof(echo)))>0)
+                    port.received+=n;
+                if(write(port.pty->master(),message,sizeof(message))>0)
+                    port.sent+=sizeof(message);
+            }
+        }
+        double s=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        cpu=cpuTime()-cpu;
+        cout<<"ports\tthreads\tRSS\t\tCPU"<<endl;
+        cout<<ports<<"\t"<<status("Threads:")<<"\t"<<status("VmRSS:")<<"\t"
+            <<100*cpu/s<<"%"<<endl;
+
+        //Collect the last echoes
+        this_thread::sleep_for(chrono::milliseconds(100));
+        for(auto& port : p)
+        {
+            ssize_t n;
+            while((n=read(port.pty->master(),echo,sizeof(echo)))>0)
+                port.received+=n;
+            lost+=port.sent-port.received;
+            port.serial->close();
+            port.pty.reset();
+        }
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<"Bytes lost: "<<lost<<endl;
+    return lost==0 ? 0 : 1;
+}
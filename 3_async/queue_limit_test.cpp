@@ -0,0 +1,188 @@
+/*
+ * Write queue limit test for AsyncSerial.
+ * The other end of the port is a pseudo terminal that this program leaves
+ * undrained, so that the write queue fills up. Checks the Fail, DropOldest
+ * and Block policies, tryWrite(), and the watermark callbacks. Whatever is
+ * accepted must arrive whole and in order, dropped data only as whole
+ * messages. The backend is given as argument, "asio", "epoll" or "uring".
+ * Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+static const size_t messageSize=1024;
+static const size_t highWater=32*1024;
+static const size_t lowWater=8*1024;
+
+/**
+ * \return message number i, the number followed by padding and a newline
+ */
+static string message(int i)
+{
+    char number[16];
+    snprintf(number,sizeof(number),"%06d",i);
+    string result(number);
+    result.resize(messageSize-1,'.');
+    return result+"\n";
+}
+
+/**
+ * Read all the data the port sends, until it stops for a while, and check
+ * that it is made of whole messages in increasing order
+ * \return the number of messages received, the last one in *last
+ */
+static int drain(PseudoTerminal& pty, int *last)
+{
+    string received;
+    for(;;)
+    {
+        string s=pty.read(65536,chrono::milliseconds(300));
+        if(s.empty()) break;
+        received+=s;
+    }
+    check(received.size()%messageSize==0,"partial message received");
+    int count=0;
+    *last=-1;
+    for(size_t i=0;i+messageSize<=received.size();i+=messageSize)
+    {
+        int n=atoi(received.c_str()+i);
+        if(received.compare(i,messageSize,message(n))!=0 || n<=*last)
+        {
+            check(false,"message corrupted or out of order at offset "+
+                to_string(i));
+            break;
+        }
+        *last=n;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Wait up to a second for a counter to reach a value
+ */
+static bool waitCount(const atomic<int>& counter, int value)
+{
+    auto deadline=chrono::steady_clock::now()+chrono::seconds(1);
+    while(counter<value && chrono::steady_clock::now()<deadline)
+        this_thread::sleep_for(chrono::milliseconds(1));
+    return counter>=value;
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        atomic<int> high(0), low(0);
+        serial.setWriteQueueCallbacks([&high]{ high++; },[&low]{ low++; });
+        serial.setWriteQueueLimit(highWater,lowWater,AsyncSerial::Fail);
+        serial.open(pty.name(),115200);
+
+        //Fail, writes are refused once the queue is full
+        int accepted=0;
+        try {
+            for(;accepted<10000;accepted++)
+            {
+                serial.writeString(message(accepted));
+                check(serial.writeQueueSize()<=highWater,"queue above limit");
+            }
+        } catch(boost::system::system_error& e)
+        {
+            check(e.code()==boost::asio::error::no_buffer_space,
+                "wrong error code for a full queue");
+        }
+        check(accepted<10000,"Fail policy never refused a write");
+        //The kernel may still make room in the pty for a while
+        bool refused=false;
+        for(int i=0;i<100 && refused==false;i++)
+        {
+            this_thread::sleep_for(chrono::milliseconds(20));
+            if(serial.tryWriteString(message(accepted))) accepted++;
+            else refused=true;
+        }
+        check(refused,"tryWrite() accepted writes with a full queue");
+        check(waitCount(high,1),"high watermark callback not called");
+        check(low==0,"low watermark callback called early");
+        int last;
+        check(drain(pty,&last)==accepted && last==accepted-1,
+            "accepted writes lost");
+        check(waitCount(low,1),"low watermark callback not called");
+        check(serial.writeQueueSize()==0,"queue not empty after draining");
+        check(serial.tryWriteString(message(accepted)),
+            "tryWrite() refused a write with an empty queue");
+        check(drain(pty,&last)==1 && last==accepted,"tryWrite() data lost");
+
+        //DropOldest, writes never fail, old messages are dropped
+        serial.setWriteQueueLimit(highWater,lowWater,AsyncSerial::DropOldest);
+        const int first=accepted+1;
+        for(int i=first;i<first+500;i++) serial.writeString(message(i));
+        int received=drain(pty,&last);
+        check(received<500,"DropOldest dropped nothing");
+        check(last==first+499,"DropOldest dropped the newest message");
+
+        //Block, writers wait for room
+        serial.setWriteQueueLimit(highWater,lowWater,AsyncSerial::Block);
+        const int next=first+500;
+        atomic<bool> done(false);
+        thread writer([&]{
+            for(int i=next;i<next+300;i++) serial.writeString(message(i));
+            done=true;
+        });
+        for(int i=0;i<100;i++)
+        {
+            check(serial.writeQueueSize()<=highWater,"Block exceeded the limit");
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        check(done==false,"Block policy did not block");
+        received=drain(pty,&last);
+        writer.join();
+        check(received==300 && last==next+299,"Block writes lost");
+        check(serial.errorStatus()==false,"port in error status");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
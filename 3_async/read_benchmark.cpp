@@ -0,0 +1,202 @@
+/*
+ * Read benchmark for AsyncSerial.
+ * The other end of each port is a pseudo terminal written by this program.
+ * Linux only, as it uses a pseudo terminal. Arguments, in any order:
+ * - the test, one of
+ *   throughput  (default) read mb=N megabytes, in 64KB writes, from each of
+ *               ports=N ports, reports MB/s, CPU time and callbacks
+ *   stall       write 1KB every 100us for 2s while the read callback sleeps
+ *               5ms every 50 calls, reports the writes refused by a full pty
+ *   timestamp   send 32 bytes at a time, reports the latency from the write
+ *               to the ReadInfo timestamp and to the callback
+ * - the backend, "epoll" or "uring", default is asio
+ * - size=N and max=N, the read buffer size, see setReadBufferSize()
+ * - buffers=N and "consumer", see setReadBuffers()
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+/**
+ * \return the value of a numeric name=value argument, or def if not given
+ */
+static size_t option(int argc, char *argv[], const char *name, size_t def)
+{
+    size_t len=strlen(name);
+    for(int i=1;i<argc;i++)
+        if(strncmp(argv[i],name,len)==0 && argv[i][len]=='=')
+            return strtoul(argv[i]+len+1,nullptr,10);
+    return def;
+}
+
+/**
+ * \return true if the argument was given
+ */
+static bool flag(int argc, char *argv[], const char *name)
+{
+    for(int i=1;i<argc;i++) if(strcmp(argv[i],name)==0) return true;
+    return false;
+}
+
+/**
+ * \return CPU time used by the process so far, in seconds
+ */
+static double cpuTime()
+{
+    rusage r;
+    getrusage(RUSAGE_SELF,&r);
+    return r.ru_utime.tv_sec+r.ru_stime.tv_sec+
+        (r.ru_utime.tv_usec+r.ru_stime.tv_usec)/1e6;
+}
+
+/**
+ * Configure a port as requested by the arguments
+ */
+static void configure(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(flag(argc,argv,"epoll")) serial.setBackend(AsyncSerial::EpollBackend);
+    if(flag(argc,argv,"uring")) serial.setBackend(AsyncSerial::UringBackend);
+    size_t size=option(argc,argv,"size",serial.getReadBufferSize());
+    serial.setReadBufferSize(size,option(argc,argv,"max",0));
+    serial.setReadBuffers(option(argc,argv,"buffers",2),
+        flag(argc,argv,"consumer"));
+}
+
+static void throughput(int argc, char *argv[])
+{
+    const size_t ports=option(argc,argv,"ports",1);
+    const size_t total=option(argc,argv,"mb",256)<<20;
+    vector<unique_ptr<PseudoTerminal>> ptys;
+    vector<unique_ptr<CallbackAsyncSerial>> serials;
+    atomic<size_t> received(0);
+    atomic<size_t> callbacks(0);
+    for(size_t i=0;i<ports;i++)
+    {
+        ptys.push_back(unique_ptr<PseudoTerminal>(new PseudoTerminal));
+        serials.push_back(unique_ptr<CallbackAsyncSerial>(
+            new CallbackAsyncSerial));
+        configure(*serials.back(),argc,argv);
+        serials.back()->setCallback([&](const char*, size_t n){
+            received.fetch_add(n,memory_order_relaxed);
+            callbacks.fetch_add(1,memory_order_relaxed);
+        });
+        serials.back()->open(ptys.back()->name(),115200);
+    }
+    double cpu=cpuTime();
+    auto start=chrono::steady_clock::now();
+    vector<thread> writers;
+    for(auto& p : ptys)
+    {
+        PseudoTerminal *pty=p.get();
+        writers.push_back(thread([pty,total]{
+            string data(65536,'x');
+            for(size_t sent=0;sent<total;sent+=data.size())
+                if(pty->write(data.substr(0,min(data.size(),total-sent)))==false)
+                    break;
+        }));
+    }
+    for(auto& w : writers) w.join();
+    while(received<ports*total) this_thread::sleep_for(chrono::microseconds(100));
+    double s=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    cpu=cpuTime()-cpu;
+    double mb=ports*total/1e6;
+    cout<<"MB/s\tCPU ms/MB\tcallbacks\tbytes/callback\tbuffer size"<<endl;
+    cout<<mb/s<<"\t"<<cpu/mb*1e3<<"\t\t"<<callbacks<<"\t\t"
+        <<ports*total/callbacks<<"\t\t"<<serials.front()->getReadBufferSize()
+        <<endl;
+    for(auto& serial : serials) serial->close();
+}
+
+static void stall(int argc, char *argv[])
+{
+    PseudoTerminal pty;
+    CallbackAsyncSerial serial;
+    configure(serial,argc,argv);
+    size_t calls=0;
+    serial.setCallback([&](const char*, size_t){
+        if(++calls % 50==0) this_thread::sleep_for(chrono::milliseconds(5));
+    });
+    serial.open(pty.name(),115200);
+    //Count the writes the pty refuses instead of waiting for room
+    fcntl(pty.master(),F_SETFL,fcntl(pty.master(),F_GETFL) | O_NONBLOCK);
+    char data[1024];
+    memset(data,'x',sizeof(data));
+    size_t writes=0, refused=0;
+    auto end=chrono::steady_clock::now()+chrono::seconds(2);
+    for(auto next=chrono::steady_clock::now();next<end;
+        next+=chrono::microseconds(100))
+    {
+        this_thread::sleep_until(next);
+        writes++;
+        if(write(pty.master(),data,sizeof(data))!=sizeof(data)) refused++;
+    }
+    cout<<"writes\trefused"<<endl;
+    cout<<writes<<"\t"<<100.0*refused/writes<<"%"<<endl;
+    serial.close();
+}
+
+static void timestamp(int argc, char *argv[])
+{
+    PseudoTerminal pty;
+    CallbackAsyncSerial serial;
+    configure(serial,argc,argv);
+    const int samples=20000;
+    chrono::steady_clock::time_point sent;
+    vector<double> toTimestamp, toCallback;
+    atomic<bool> done(false);
+    serial.setTimestampedCallback([&](const char*, size_t,
+        const AsyncSerial::ReadInfo& info){
+        auto now=chrono::steady_clock::now();
+        if(done) return; //Rest of a message split in two reads
+        toTimestamp.push_back(chrono::duration<double,micro>(
+            info.monotonic-sent).count());
+        toCallback.push_back(chrono::duration<double,micro>(now-sent).count());
+        done=true;
+    });
+    serial.open(pty.name(),115200);
+    char data[32];
+    memset(data,'x',sizeof(data));
+    for(int i=0;i<samples;i++)
+    {
+        done=false;
+        sent=chrono::steady_clock::now();
+        if(write(pty.master(),data,sizeof(data))!=sizeof(data)) break;
+        while(!done) this_thread::yield();
+    }
+    serial.close();
+    if(toTimestamp.empty()) throw runtime_error("No data received");
+    sort(toTimestamp.begin(),toTimestamp.end());
+    sort(toCallback.begin(),toCallback.end());
+    cout<<"p50 us\twrite to timestamp\twrite to callback"<<endl;
+    cout<<"\t"<<toTimestamp[toTimestamp.size()/2]<<"\t\t\t"
+        <<toCallback[toCallback.size()/2]<<endl;
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        if(flag(argc,argv,"stall")) stall(argc,argv);
+        else if(flag(argc,argv,"timestamp")) timestamp(argc,argv);
+        else throughput(argc,argv);
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+}
@@ -0,0 +1,171 @@
+/*
+ * Read buffer size test for AsyncSerial.
+ * The other end of the port is a pseudo terminal written by this program.
+ * Checks that the read callback never gets more than the read buffer size,
+ * that the size can be changed while the port is open, and that in adaptive
+ * mode the buffer grows under a burst and shrinks back under a trickle. The
+ * backend is given as argument, "asio", "epoll" or "uring".
+ * Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+/**
+ * Data received by the read callback
+ */
+class Received
+{
+public:
+    Received(): largest(0) {}
+
+    void add(const char *data, size_t size)
+    {
+        lock_guard<mutex> l(m);
+        received.append(data,size);
+        largest=max(largest,size);
+    }
+
+    /**
+     * Wait up to 5s for size bytes
+     * \return the data received so far and the largest chunk, and clear
+     * them
+     */
+    string take(size_t size, size_t& largestChunk)
+    {
+        auto deadline=chrono::steady_clock::now()+chrono::seconds(5);
+        for(;;)
+        {
+            {
+                lock_guard<mutex> l(m);
+                if(received.size()>=size ||
+                   chrono::steady_clock::now()>=deadline)
+                {
+                    string result;
+                    result.swap(received);
+                    largestChunk=largest;
+                    largest=0;
+                    return result;
+                }
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+private:
+    mutex m;
+    string received;
+    size_t largest;
+};
+
+/**
+ * \return size bytes of test data
+ */
+static string pattern(size_t size)
+{
+    string result;
+    for(size_t i=0;i<size;i++) result+=static_cast<char>(i%251);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        Received received;
+        serial.setCallback([&received](const char *data, size_t size){
+            received.add(data,size);
+        });
+        bool invalid=false;
+        try {
+            serial.setReadBufferSize(0);
+        } catch(invalid_argument&)
+        {
+            invalid=true;
+        }
+        check(invalid,"setReadBufferSize(0) accepted");
+
+        //Fixed size
+        serial.setReadBufferSize(16);
+        serial.open(pty.name(),115200);
+        string data=pattern(100000);
+        pty.write(data);
+        size_t largest;
+        check(received.take(data.size(),largest)==data,"fixed size data");
+        check(largest<=16,"chunk larger than the read buffer");
+        check(serial.getReadBufferSize()==16,"fixed size changed");
+
+        //Changed while open, takes effect from the next read
+        serial.setReadBufferSize(8);
+        pty.write("x");
+        received.take(1,largest);
+        pty.write(data);
+        check(received.take(data.size(),largest)==data,"resized data");
+        check(largest<=8,"chunk larger than the resized read buffer");
+
+        //Adaptive, grows under a burst
+        serial.setReadBufferSize(64,4096);
+        pty.write("x");
+        received.take(1,largest);
+        data=pattern(1<<20);
+        pty.write(data);
+        check(received.take(data.size(),largest)==data,"adaptive data");
+        size_t grown=serial.getReadBufferSize();
+        check(largest<=4096 && grown<=4096,"grew beyond maxSize");
+        check(grown>64,"did not grow under a burst");
+
+        //Shrinks back under a trickle
+        for(int i=0;i<800;i++)
+        {
+            pty.write("ab");
+            received.take(2,largest);
+        }
+        check(serial.getReadBufferSize()<grown,"did not shrink");
+        check(serial.getReadBufferSize()>=64,"shrank below size");
+        check(serial.errorStatus()==false,"port in error status");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/*
+ * AsyncSerialService test.
+ * Many ports share the threads of a service, the read callback of each one
+ * echoes back what it receives, and the other end of every port is a pseudo
+ * terminal where this program sends data and reads back the echo. Checks
+ * that every port echoes all its data, that the callback of a port never
+ * runs concurrently with itself, that ports keep working when others close,
+ * and that with the asio backend the ports add no threads. The backend is
+ * given as argument, "asio", "epoll" or "uring". Linux only, as it uses
+ * openpty().
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+/**
+ * \return the number of threads of this process
+ */
+static int threadCount()
+{
+    ifstream in("/proc/self/status");
+    string line;
+    while(getline(in,line))
+        if(line.compare(0,8,"Threads:")==0) return atoi(line.c_str()+8);
+    return -1;
+}
+
+/**
+ * A port under test and the pseudo terminal at its other end
+ */
+struct Port
+{
+    Port(AsyncSerialService& service): serial(service), inCallback(false),
+            overlapped(false) {}
+
+    PseudoTerminal pty;
+    CallbackAsyncSerial serial;
+    atomic<bool> inCallback;
+    atomic<bool> overlapped;
+};
+
+static const int portCount=16;
+
+/**
+ * Send a message to each open port and check that it is echoed back
+ */
+static void echoAll(vector<unique_ptr<Port>>& ports, const string& what)
+{
+    for(size_t i=0;i<ports.size();i++)
+        if(ports[i]->serial.isOpen())
+            ports[i]->pty.write(what+" "+to_string(i)+string(2000,'.'));
+    for(size_t i=0;i<ports.size();i++)
+    {
+        if(ports[i]->serial.isOpen()==false) continue;
+        string expected=what+" "+to_string(i)+string(2000,'.');
+        check(ports[i]->pty.read(expected.size(),chrono::seconds(5))==expected,
+            what+": port "+to_string(i)+" echo lost");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        const int threadsBefore=threadCount();
+        AsyncSerialService service(4);
+        check(service.threadCount()==4,"wrong service thread count");
+        check(threadCount()==threadsBefore+4,"service threads not started");
+        vector<unique_ptr<Port>> ports;
+        for(int i=0;i<portCount;i++)
+        {
+            ports.push_back(unique_ptr<Port>(new Port(service)));
+            Port *port=ports.back().get();
+            setBackend(port->serial,argc,argv);
+            port->serial.setCallback([port](const char *data, size_t size){
+                if(port->inCallback.exchange(true)) port->overlapped=true;
+                port->serial.write(data,size);
+                this_thread::yield();
+                port->inCallback=false;
+            });
+            port->serial.open(port->pty.name(),115200);
+        }
+        if(argc<2 || strcmp(argv[1],"asio")==0)
+            check(threadCount()==threadsBefore+4,"ports started threads");
+
+        echoAll(ports,"all open");
+        for(int i=0;i<portCount;i+=2) ports[i]->serial.close();
+        echoAll(ports,"half closed");
+        ports[0]->serial.open(ports[0]->pty.name(),115200);
+        echoAll(ports,"one reopened");
+        for(auto& port : ports)
+        {
+            check(port->overlapped==false,"callback ran concurrently");
+            check(port->serial.errorStatus()==false,"port in error status");
+            port->serial.close();
+        }
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
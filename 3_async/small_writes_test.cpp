@@ -0,0 +1,105 @@
+/*
+ * Small writes test for AsyncSerial.
+ * The other end of the port is a pseudo terminal read by this program.
+ * Checks that single byte writes all arrive in order, also when they come
+ * in bursts that let the write queue run empty in between, so that every
+ * burst has to schedule a write again, and when they are made from the read
+ * callback. The backend is given as argument, "asio", "epoll" or "uring".
+ * Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        serial.setCallback([&serial](const char *data, size_t size){
+            serial.write(data,size); //Echo
+        });
+        serial.open(pty.name(),115200);
+
+        string expected;
+        for(int i=0;i<100000;i++) expected+=static_cast<char>(i%251);
+        string received;
+        thread reader([&]{
+            received=pty.read(expected.size(),chrono::seconds(10));
+        });
+        for(char c : expected) serial.write(&c,1);
+        reader.join();
+        check(received==expected,"single byte writes lost or out of order");
+
+        //Bursts, after each the queue runs empty
+        expected.clear();
+        reader=thread([&]{
+            received=pty.read(200*55,chrono::seconds(10));
+        });
+        for(int i=0;i<200;i++)
+        {
+            for(int j=0;j<10;j++)
+            {
+                string s(j+1,'a'+j);
+                expected+=s;
+                serial.writeString(s);
+            }
+            this_thread::sleep_for(chrono::microseconds(500));
+        }
+        reader.join();
+        check(received==expected,"burst writes lost or out of order");
+
+        //Writes from the read callback
+        expected.clear();
+        for(int i=0;i<1000;i++) expected+="line "+to_string(i)+"\n";
+        reader=thread([&]{
+            received=pty.read(expected.size(),chrono::seconds(10));
+        });
+        for(size_t i=0;i<expected.size();i+=7)
+            pty.write(expected.substr(i,7));
+        reader.join();
+        check(received==expected,"echoed data lost or out of order");
+        check(serial.errorStatus()==false,"port in error status");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/*
+ * Statistics test for AsyncSerial.
+ * The other end of the port is a pseudo terminal driven by this program.
+ * Checks the byte and chunk counters, the histograms, the write queue peak
+ * and the error and reopen counters after a hangup against what the test
+ * did, and that resetStats() zeroes them. The backend is given as argument,
+ * "asio", "epoll" or "uring". Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+/**
+ * Wait up to 5s for the statistics to satisfy a condition
+ * \return the last statistics read
+ */
+template<typename Cond>
+static AsyncSerial::Stats waitStats(AsyncSerial& serial, Cond cond)
+{
+    auto deadline=chrono::steady_clock::now()+chrono::seconds(5);
+    AsyncSerial::Stats s=serial.getStats();
+    while(cond(s)==false && chrono::steady_clock::now()<deadline)
+    {
+        this_thread::sleep_for(chrono::milliseconds(1));
+        s=serial.getStats();
+    }
+    return s;
+}
+
+/**
+ * \return the sum of the buckets of a histogram
+ */
+static uint64_t total(const uint64_t (&histogram)[AsyncSerial::Stats::histogramSize])
+{
+    uint64_t result=0;
+    for(uint64_t count : histogram) result+=count;
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        unique_ptr<PseudoTerminal> pty(new PseudoTerminal);
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        atomic<size_t> received(0), callbacks(0);
+        serial.setCallback([&](const char *data, size_t size){
+            received+=size;
+            callbacks++;
+        });
+        serial.open(pty->name(),115200);
+
+        AsyncSerial::Stats s=serial.getStats();
+        check(s.bytesReceived==0 && s.bytesSent==0,"counters not zero");
+        check(s.errors==0 && s.reopens==0,"error counters not zero");
+
+        //Reads
+        const size_t readSize=10000;
+        for(size_t sent=0;sent<readSize;sent+=100)
+        {
+            pty->write(string(100,'r'));
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+        s=waitStats(serial,[&](const AsyncSerial::Stats& s){
+            return s.bytesReceived==readSize &&
+                   total(s.callbackTimes)==callbacks;
+        });
+        check(received==readSize,"data lost");
+        check(s.bytesReceived==readSize,"wrong bytesReceived");
+        check(s.chunksReceived==callbacks,"wrong chunksReceived");
+        check(total(s.readSizes)==s.chunksReceived,"wrong read size histogram");
+        check(total(s.callbackTimes)==callbacks,"wrong callback histogram");
+
+        //Writes, the pty is read only after the data is queued
+        const size_t writeSize=1<<20;
+        serial.writeString(string(writeSize,'w'));
+        s=serial.getStats();
+        check(s.writeQueuePeak>=writeSize/2,"write queue peak too small");
+        check(pty->read(writeSize,chrono::seconds(10)).size()==writeSize,
+            "write lost");
+        s=waitStats(serial,[&](const AsyncSerial::Stats& s){
+            return s.bytesSent==writeSize && s.writeQueueSize==0;
+        });
+        check(s.bytesSent==writeSize,"wrong bytesSent");
+        check(s.chunksSent>=1 && s.chunksSent<=s.bytesSent,"wrong chunksSent");
+        check(s.writeQueueSize==0,"write queue not empty");
+        check(s.writeQueuePeak>=writeSize/2,"write queue peak forgotten");
+
+        serial.resetStats();
+        s=serial.getStats();
+        check(s.bytesReceived==0 && s.chunksReceived==0,"reads not reset");
+        check(s.bytesSent==0 && s.chunksSent==0,"writes not reset");
+        check(total(s.readSizes)==0 && total(s.callbackTimes)==0,
+            "histograms not reset");
+        check(s.writeQueuePeak==0,"write queue peak not reset");
+
+        //Hangup and reopen
+        pty->closeMaster();
+        s=waitStats(serial,[](const AsyncSerial::Stats& s){
+            return s.errors>0;
+        });
+        check(s.errors==1,"hangup not counted once");
+        try {
+            serial.close();
+        } catch(boost::system::system_error&)
+        {
+            //close() reports the error status
+        }
+        pty.reset(new PseudoTerminal);
+        serial.open(pty->name(),115200);
+        s=serial.getStats();
+        check(s.reopens==1,"reopen not counted");
+        check(s.errors==1,"error count lost on reopen");
+        pty->write("x");
+        s=waitStats(serial,[](const AsyncSerial::Stats& s){
+            return s.bytesReceived==1;
+        });
+        check(s.bytesReceived==1,"counters not kept across reopen");
+
+        serial.resetStats();
+        s=serial.getStats();
+        check(s.errors==0 && s.reopens==0,"error counters not reset");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/*
+ * Thread options test for AsyncSerial.
+ * The read callback echoes back what it receives and records the CPU and
+ * scheduling policy of the thread running it, the other end of the port is
+ * a pseudo terminal driven by this program. Checks that the options are
+ * applied, or reported by threadOptionsError() when they can't be, that the
+ * port works either way, and that invalid priorities are rejected. The
+ * backend is given as argument, "asio", "epoll" or "uring". Linux only, as
+ * it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+/**
+ * Check that the port echoes back what the pseudo terminal sends
+ */
+static void checkEcho(PseudoTerminal& pty, const string& name)
+{
+    for(int i=0;i<10;i++)
+    {
+        string message="ping "+to_string(i);
+        pty.write(message);
+        if(pty.read(message.size(),chrono::seconds(2))!=message)
+        {
+            check(false,name+": echo lost");
+            return;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        atomic<int> cpu(-1), policy(-1);
+        serial.setCallback([&](const char *data, size_t size){
+            cpu=sched_getcpu();
+            sched_param param;
+            int p;
+            if(pthread_getschedparam(pthread_self(),&p,&param)==0) policy=p;
+            serial.write(data,size); //Echo
+        });
+
+        bool invalid=false;
+        try {
+            serial.setThreadScheduling(AsyncSerial::FifoScheduling,0);
+        } catch(invalid_argument&)
+        {
+            invalid=true;
+        }
+        check(invalid,"real time priority 0 accepted");
+        invalid=false;
+        try {
+            serial.setThreadScheduling(AsyncSerial::RoundRobinScheduling,100);
+        } catch(invalid_argument&)
+        {
+            invalid=true;
+        }
+        check(invalid,"real time priority 100 accepted");
+
+        //A CPU that does not exist can't be applied, but the port still works
+        serial.setThreadAffinity({1000});
+        serial.open(pty.name(),115200);
+        checkEcho(pty,"invalid affinity");
+        check(serial.threadOptionsError().find("CPU affinity")!=string::npos,
+            "invalid affinity not reported");
+        serial.close();
+
+        serial.setThreadAffinity({0});
+        serial.setThreadScheduling(AsyncSerial::FifoScheduling,10);
+        serial.setThreadStackLock(64*1024);
+        serial.open(pty.name(),115200);
+        checkEcho(pty,"all options");
+        string error=serial.threadOptionsError();
+        check(error.find("CPU affinity")==string::npos,"affinity not applied");
+        check(cpu==0,"callback not run on CPU 0");
+        //Real time scheduling and memory locking need privileges
+        if(error.find("Real time scheduling")==string::npos)
+            check(policy==SCHED_FIFO,"callback not run with SCHED_FIFO");
+        else cout<<"Skipped: "<<error<<endl;
+        serial.close();
+
+        serial.setThreadAffinity({});
+        serial.setThreadScheduling(AsyncSerial::DefaultScheduling);
+        serial.setThreadStackLock(0);
+        serial.open(pty.name(),115200);
+        checkEcho(pty,"no options");
+        check(serial.threadOptionsError().empty(),"error not cleared");
+        check(policy==SCHED_OTHER,"callback not run with SCHED_OTHER");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
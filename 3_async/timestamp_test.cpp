@@ -0,0 +1,152 @@
+/*
+ * Read timestamp test for AsyncSerial.
+ * The other end of the port is a pseudo terminal written by this program
+ * with fixed size messages, each sent after taking the time. Checks that
+ * the arrival time of every chunk lies between the write of its first byte
+ * and the callback, that sequence and offset count the chunks and bytes
+ * since open(), and that the wall clock time is taken only when requested.
+ * The backend is given as argument, "asio", "epoll" or "uring". Linux only,
+ * as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+/**
+ * A chunk as seen by the timestamped callback
+ */
+struct Chunk
+{
+    size_t size;
+    AsyncSerial::ReadInfo info;
+    chrono::steady_clock::time_point called; ///< When the callback ran
+};
+
+static const int messageCount=50;
+static const size_t messageSize=8;
+
+/**
+ * Send the messages and check the chunks the callback received
+ */
+static void run(CallbackAsyncSerial& serial, PseudoTerminal& pty,
+        bool realtime, const string& name)
+{
+    mutex m;
+    vector<Chunk> chunks;
+    size_t received=0;
+    serial.setTimestampedCallback([&](const char *data, size_t size,
+            const AsyncSerial::ReadInfo& info){
+        Chunk c;
+        c.size=size;
+        c.info=info;
+        c.called=chrono::steady_clock::now();
+        lock_guard<mutex> l(m);
+        chunks.push_back(c);
+        received+=size;
+    },realtime);
+    serial.open(pty.name(),115200);
+
+    vector<chrono::steady_clock::time_point> written;
+    for(int i=0;i<messageCount;i++)
+    {
+        written.push_back(chrono::steady_clock::now());
+        pty.write(string(messageSize,'a'+i%26));
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    auto deadline=chrono::steady_clock::now()+chrono::seconds(5);
+    for(;;)
+    {
+        {
+            lock_guard<mutex> l(m);
+            if(received>=messageCount*messageSize) break;
+        }
+        if(chrono::steady_clock::now()>deadline) break;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    serial.close();
+
+    check(received==messageCount*messageSize,name+": data lost");
+    uint64_t offset=0;
+    for(size_t i=0;i<chunks.size();i++)
+    {
+        const Chunk& c=chunks[i];
+        if(c.info.sequence!=i || c.info.offset!=offset)
+        {
+            check(false,name+": wrong sequence or offset");
+            break;
+        }
+        size_t first=offset/messageSize;
+        if(c.info.monotonic<written.at(first) || c.info.monotonic>c.called)
+        {
+            check(false,name+": arrival time out of range");
+            break;
+        }
+        auto wall=chrono::system_clock::now();
+        if(realtime)
+        {
+            if(c.info.realtime>wall || wall-c.info.realtime>chrono::seconds(10))
+            {
+                check(false,name+": wrong wall clock time");
+                break;
+            }
+        } else if(c.info.realtime!=chrono::system_clock::time_point())
+        {
+            check(false,name+": wall clock time taken when not requested");
+            break;
+        }
+        offset+=c.size;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        run(serial,pty,false,"monotonic");
+        //Reopening restarts sequence and offset
+        run(serial,pty,true,"realtime");
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/*
+ * Write contention benchmark for AsyncSerial.
+ * Many threads write fixed size messages to the same port, the other end of
+ * the port is a pseudo terminal read by this program, that checks that no
+ * two messages were interleaved. Linux only, as it uses a pseudo terminal.
+ * Run as "write_benchmark epoll" or "write_benchmark uring" to use the epoll
+ * or io_uring backend. An optional second argument sets the message size,
+ * default is 32 bytes, as in "write_benchmark asio 256". The single thread
+ * row is the write throughput of a port.
+ */
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+/**
+ * AsyncSerial is abstract, and this benchmark has no use for a read callback
+ */
+class WriteOnlySerial: public AsyncSerial
+{
+public:
+    WriteOnlySerial(const string& devname, Backend backend)
+    {
+        setBackend(backend);
+        open(devname,115200);
+    }
+};
+
+static size_t messageSize=32;
+static const size_t totalMessages=400000;
+
+/**
+ * \return CPU time used by the process so far, in seconds
+ */
+static double cpuTime()
+{
+    rusage r;
+    getrusage(RUSAGE_SELF,&r);
+    return r.ru_utime.tv_sec+r.ru_stime.tv_sec+
+        (r.ru_utime.tv_usec+r.ru_stime.tv_usec)/1e6;
+}
+
+/**
+ * Read from the pty master until all messages arrived.
+ * Every message is made of a single repeated character, so an interleaved
+ * message shows up as a mixed messageSize chunk
+ * \return true if no message was interleaved
+ */
+static bool drain(int fd)
+{
+    vector<char> buffer(65536);
+    size_t pending=0; //Bytes of the current message received so far
+    char current=0;
+    bool ok=true;
+    for(size_t received=0;received<totalMessages*messageSize;)
+    {
+        ssize_t n=read(fd,buffer.data(),buffer.size());
+        if(n<=0) return false;
+        for(ssize_t i=0;i<n;i++)
+        {
+            if(pending==0) current=buffer[i];
+            else if(buffer[i]!=current) ok=false;
+            if(++pending==messageSize) pending=0;
+        }
+        received+=n;
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        AsyncSerial::Backend backend=AsyncSerial::AsioBackend;
+        if(argc>1 && strcmp(argv[1],"epoll")==0)
+            backend=AsyncSerial::EpollBackend;
+        if(argc>1 && strcmp(argv[1],"uring")==0)
+            backend=AsyncSerial::UringBackend;
+        if(argc>2) messageSize=atoi(argv[2]);
+        if(messageSize==0) throw invalid_argument("Bad message size");
+        WriteOnlySerial serial(pty.name(),backend);
+        //write() throughput measures contention between producers, total
+        //throughput and CPU time include the time to drain the pty
+        cout<<"threads\twrite() Mmsg/s\ttotal MB/s\tCPU ms/MB\tinterleaved"
+            <<endl;
+        for(int threads=1;threads<=32;threads*=2)
+        {
+            bool ok=false;
+            thread reader([&]{ ok=drain(pty.master()); });
+            double cpu=cpuTime();
+            auto start=chrono::steady_clock::now();
+            vector<thread> writers;
+            for(int i=0;i<threads;i++)
+            {
+                writers.push_back(thread([&serial,i,threads]{
+                    vector<char> message(messageSize,'A'+i);
+                    for(size_t j=i;j<totalMessages;j+=threads)
+                        serial.write(message.data(),messageSize);
+                }));
+            }
+            for(auto& w : writers) w.join();
+            auto written=chrono::steady_clock::now();
+            reader.join();
+            auto end=chrono::steady_clock::now();
+            cpu=cpuTime()-cpu;
+            double mb=totalMessages*messageSize/1e6;
+            double w=chrono::duration<double>(written-start).count();
+            double s=chrono::duration<double>(end-start).count();
+            cout<<threads<<"\t"<<totalMessages/w/1e6<<"\t\t"
+                <<mb/s<<"\t\t"<<cpu/mb*1e3<<"\t\t"
+                <<(ok ? "no" : "YES")<<endl;
+        }
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+}
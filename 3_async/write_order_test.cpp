@@ -0,0 +1,83 @@
+/*
+ * Write ordering test for AsyncSerial.
+ * The other end of the port is a pseudo terminal that this program reads
+ * only after queueing all the writes, so that the port fills up and writes
+ * complete partially. Checks that writes of mixed sizes arrive whole and in
+ * order. The backend is given as argument, "asio", "epoll" or "uring".
+ * Linux only, as it uses openpty().
+ */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "AsyncSerial.h"
+#include "PseudoTerminal.h"
+
+using namespace std;
+
+static int failures=0;
+
+/**
+ * Count a failure if a condition is false
+ */
+static void check(bool condition, const string& what)
+{
+    if(condition) return;
+    cout<<"Failed: "<<what<<endl;
+    failures++;
+}
+
+/**
+ * Select the backend named by the first argument, default is asio
+ */
+static void setBackend(AsyncSerial& serial, int argc, char *argv[])
+{
+    if(argc<2 || strcmp(argv[1],"asio")==0) return;
+    if(strcmp(argv[1],"epoll")==0) serial.setBackend(AsyncSerial::EpollBackend);
+    else if(strcmp(argv[1],"uring")==0)
+        serial.setBackend(AsyncSerial::UringBackend);
+    else throw invalid_argument(string("Unknown backend ")+argv[1]);
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        PseudoTerminal pty;
+        CallbackAsyncSerial serial;
+        setBackend(serial,argc,argv);
+        serial.open(pty.name(),115200);
+
+        //Far more than the pty can buffer, in messages of mixed sizes
+        string expected;
+        for(int i=0;i<2000;i++)
+        {
+            string message;
+            for(int j=0;j<(i*37)%3000+1;j++)
+                message+=static_cast<char>((expected.size()+j)%251);
+            expected+=message;
+            if(i%2) serial.writeString(message);
+            else serial.write(message.data(),message.size());
+        }
+        string received=pty.read(expected.size(),chrono::seconds(10));
+        check(received.size()==expected.size(),"received "+
+            to_string(received.size())+" of "+to_string(expected.size())+
+            " bytes");
+        check(received==expected,"data out of order");
+        check(serial.writeQueueSize()==0,"write queue not empty");
+
+        //Writes after the queue drained
+        serial.writeString("end");
+        check(pty.read(3,chrono::seconds(2))=="end","write after draining");
+        check(serial.errorStatus()==false,"port in error status");
+        serial.close();
+    } catch(exception& e)
+    {
+        cout<<"Error: "<<e.what()<<endl;
+        return 1;
+    }
+    cout<<(failures==0 ? "OK" : "FAILED")<<endl;
+    return failures==0 ? 0 : 1;
+}
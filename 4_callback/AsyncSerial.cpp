@@ -4,6 +4,45 @@
  * Distributed under the Boost Software License, Version 1.0.
  * Created on September 7, 2009, 10:46 AM
  *
+ * v1.19: The epoll and io_uring backends moved to AsyncSerialEpoll.cpp and
+ * AsyncSerialUring.cpp. Fixed reopening a port closed after an error with the
+ * asio backend
+ *
+ * v1.18: Any integer baud rate on Linux and Mac OS X, added getBaudRate()
+ *
+ * v1.17: Optional receive timestamps in the read callback
+ *
+ * v1.16: Per port statistics
+ *
+ * v1.15: Optional CPU affinity, real time scheduling and stack locking of the
+ * threads
+ *
+ * v1.14: Optional busy polling
+ *
+ * v1.13: Optional io_uring backend on Linux
+ *
+ * v1.12: Optional epoll backend on Linux
+ *
+ * v1.11: AsyncSerialService, many ports can share a pool of threads instead
+ * of having one each
+ *
+ * v1.10: Rotating read buffers, the next read starts before the read callback
+ * is called, which can optionally run in a consumer thread
+ *
+ * v1.09: Read buffer size configurable at runtime, optionally adaptive
+ *
+ * v1.08: Optional write queue limit, with backpressure policies and watermark
+ * callbacks
+ *
+ * v1.07: Lock free write queue, concurrent writes no longer contend on a mutex
+ *
+ * v1.06: Moved and shared buffers are queued without copying, and sent with
+ * a single gather write
+ *
+ * v1.05: doWrite() is posted only if no write is already scheduled
+ *
+ * v1.04: Double buffered writes, no more copies and allocations per write
+ *
  * v1.03: C++11 support
  *
  * v1.02: Fixed a bug in BufferedAsyncSerial: Using the default constructor
@@ -28,52 +67,348 @@
  */
 
 #include "AsyncSerial.h"
+#include "AsyncSerialImpl.h"
 
 #include <string>
 #include <algorithm>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <utility>
+#include <cstring>
+#include <stdexcept>
 #include <boost/bind.hpp>
-#include <boost/shared_array.hpp>
+
+#ifdef __linux__
+#include <cerrno>
+#include <system_error>
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#include "termios2.h"
+#endif //__linux__
 
 using namespace std;
 using namespace boost;
 
+//
+//Class AsyncSerialService
+//
+
+#ifndef __APPLE__
+
+/// The io_service run by the calling thread, if it is a background thread
+thread_local asio::io_service *currentIo=nullptr;
+
+/**
+ * Main loop of the background threads
+ * \param io io_service to run
+ */
+static void runIo(asio::io_service *io)
+{
+    currentIo=io;
+    io->run();
+}
+
+chrono::steady_clock::time_point spinDeadline(
+        chrono::steady_clock::duration spin)
+{
+    if(spin==chrono::steady_clock::duration::max())
+        return chrono::steady_clock::time_point::max();
+    return chrono::steady_clock::now()+spin;
+}
+
+/**
+ * Main loop of the background thread of a port that busy polls.
+ * The io_service is polled without sleeping until no handler runs for
+ * the busy polling time, then it waits for the next handler
+ * \param io io_service to run
+ * \param spin busy polling time, duration::max() to never sleep
+ */
+static void runIoBusy(asio::io_service *io, chrono::steady_clock::duration spin)
+{
+    currentIo=io;
+    for(;;)
+    {
+        chrono::steady_clock::time_point until=spinDeadline(spin);
+        while(chrono::steady_clock::now()<until)
+        {
+            if(io->poll()>0) until=spinDeadline(spin);
+            else if(io->stopped()) return; //Out of work
+        }
+        if(io->run_one()==0) return;
+    }
+}
+
+class AsyncSerialServiceImpl: private boost::noncopyable
+{
+public:
+    AsyncSerialServiceImpl(): io(), work(new asio::io_service::work(io)) {}
+
+    asio::io_service io; ///< Io service shared by the ports
+    /// Keeps the threads running while no port is open
+    std::unique_ptr<asio::io_service::work> work;
+    std::vector<std::thread> threads; ///< Worker threads
+};
+
+AsyncSerialService::AsyncSerialService(unsigned int threads)
+        : pimpl(new AsyncSerialServiceImpl)
+{
+    if(threads==0) threads=max(thread::hardware_concurrency(),1u);
+    for(unsigned int i=0;i<threads;i++)
+        pimpl->threads.push_back(thread(runIo,&pimpl->io));
+}
+
+unsigned int AsyncSerialService::threadCount() const
+{
+    return pimpl->threads.size();
+}
+
+AsyncSerialService::~AsyncSerialService()
+{
+    pimpl->work.reset();
+    pimpl->io.stop();
+    for(auto& t : pimpl->threads) t.join();
+}
+
+#else //__APPLE__
+
+class AsyncSerialServiceImpl: private boost::noncopyable {};
+
+AsyncSerialService::AsyncSerialService(unsigned int threads)
+        : pimpl(new AsyncSerialServiceImpl) {}
+
+unsigned int AsyncSerialService::threadCount() const
+{
+    return 0;
+}
+
+AsyncSerialService::~AsyncSerialService() {}
+
+#endif //__APPLE__
+
 //
 //Class AsyncSerial
 //
 
+AsyncSerial::Stats::Stats(): bytesReceived(0), chunksReceived(0),
+        bytesSent(0), chunksSent(0), writeQueueSize(0), writeQueuePeak(0),
+        errors(0), reopens(0), driverCounters(false), overruns(0),
+        bufferOverruns(0), frameErrors(0), parityErrors(0), breaks(0)
+{
+    fill(readSizes,readSizes+histogramSize,0);
+    fill(callbackTimes,callbackTimes+histogramSize,0);
+}
+
 #ifndef __APPLE__
 
-class AsyncSerialImpl: private boost::noncopyable
+thread_local WriteNodeBlock::Current WriteNodeBlock::current;
+
+WriteNode *WriteNode::create(const char *data, size_t size)
+{
+    size_t nodeSize=sizeof(WriteNode)+size;
+    WriteNodeBlock *block=nullptr;
+    void *p;
+    if(size<=WriteNodeBlock::maxNodeSize)
+        p=WriteNodeBlock::allocate(nodeSize,block);
+    else p=::operator new(nodeSize);
+    WriteNode *result=new (p) WriteNode(Inline,size,block);
+    memcpy(reinterpret_cast<char*>(result+1),data,size);
+    return result;
+}
+
+/**
+ * A node owning a moved or shared buffer
+ */
+class OwningWriteNode: public WriteNode
 {
 public:
-    AsyncSerialImpl(): io(), port(io), backgroundThread(), open(false),
-            error(false) {}
+    OwningWriteNode(Kind kind, size_t size): WriteNode(kind,size),
+            shared(nullptr) {}
 
-    boost::asio::io_service io; ///< Io service object
-    boost::asio::serial_port port; ///< Serial port object
-    std::thread backgroundThread; ///< Thread that runs read/write operations
-    bool open; ///< True if port open
-    bool error; ///< Error flag
-    mutable std::mutex errorMutex; ///< Mutex for access to error
+    std::vector<char> vec;
+    std::string str;
+    const char *shared;
+    std::shared_ptr<const void> sharedOwner;
+};
 
-    /// Data are queued here before they go in writeBuffer
-    std::vector<char> writeQueue;
-    boost::shared_array<char> writeBuffer; ///< Data being written
-    size_t writeBufferSize; ///< Size of writeBuffer
-    std::mutex writeQueueMutex; ///< Mutex for access to writeQueue
-    char readBuffer[AsyncSerial::readBufferSize]; ///< data being read
+WriteNode *WriteNode::create(std::vector<char>&& v)
+{
+    OwningWriteNode *result=new OwningWriteNode(Vector,v.size());
+    result->vec=std::move(v);
+    return result;
+}
 
-    /// Read complete callback
-    std::function<void (const char*, size_t)> callback;
+WriteNode *WriteNode::create(std::string&& s)
+{
+    OwningWriteNode *result=new OwningWriteNode(String,s.size());
+    result->str=std::move(s);
+    return result;
+}
+
+WriteNode *WriteNode::create(std::shared_ptr<const void> owner,
+        const char *data, size_t size)
+{
+    OwningWriteNode *result=new OwningWriteNode(Shared,size);
+    result->shared=data;
+    result->sharedOwner=std::move(owner);
+    return result;
+}
+
+void WriteNode::destroy(WriteNode *node, WriteNodeReleaser& releaser)
+{
+    if(node->kind==Inline && node->block)
+    {
+        WriteNodeBlock *block=node->block;
+        node->~WriteNode();
+        releaser.release(block);
+    } else destroy(node);
+}
+
+void WriteNode::destroy(WriteNode *node)
+{
+    if(node->kind!=Inline)
+    {
+        delete static_cast<OwningWriteNode*>(node);
+    } else if(node->block) {
+        WriteNodeBlock *block=node->block;
+        node->~WriteNode();
+        block->release(1);
+    } else {
+        node->~WriteNode();
+        ::operator delete(node);
+    }
+}
+
+const char *WriteNode::data() const
+{
+    //Not stored when the node is built because moving a string with the
+    //small string optimization changes its data pointer
+    const OwningWriteNode *owning=static_cast<const OwningWriteNode*>(this);
+    switch(kind)
+    {
+        case Inline: return reinterpret_cast<const char*>(this+1);
+        case Vector: return owning->vec.data();
+        case String: return owning->str.data();
+        default:     return owning->shared;
+    }
+}
+
+/**
+ * Buffer sequence referencing an array of asio::const_buffer, so that it
+ * can be passed to asio without copying the array
+ */
+class BufferRange
+{
+public:
+    typedef asio::const_buffer value_type;
+    typedef const asio::const_buffer *const_iterator;
+
+    BufferRange(const_iterator first, const_iterator last)
+            : first(first), last(last) {}
+
+    const_iterator begin() const { return first; }
+    const_iterator end() const { return last; }
+
+private:
+    const_iterator first, last;
 };
 
+//
+//Class AsyncSerialImpl
+//
+
+void *AsyncSerialImpl::applyThreadOptions()
+{
+    string failed;
+    void *locked=nullptr;
+    #ifdef __linux__
+    auto fail=[&failed](const char *what, int code)
+    {
+        if(failed.empty()==false) failed+="; ";
+        failed+=string(what)+": "+std::system_category().message(code);
+    };
+    if(threadCpus.empty()==false)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for(unsigned int cpu : threadCpus)
+            if(cpu<CPU_SETSIZE) CPU_SET(cpu,&cpus);
+        int result=pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus);
+        if(result!=0) fail("CPU affinity",result);
+    }
+    if(threadPolicy!=AsyncSerial::DefaultScheduling)
+    {
+        sched_param param;
+        param.sched_priority=threadPriority;
+        int policy=threadPolicy==AsyncSerial::FifoScheduling ?
+            SCHED_FIFO : SCHED_RR;
+        int result=pthread_setschedparam(pthread_self(),policy,&param);
+        if(result!=0) fail("Real time scheduling",result);
+    }
+    if(stackLock>0)
+    {
+        //The stack this frame is about to give back is the one the
+        //thread will use, touching it allocates the pages now
+        char *stack=static_cast<char*>(alloca(stackLock));
+        memset(stack,0,stackLock);
+        if(mlock(stack,stackLock)==0) locked=stack;
+        else fail("Stack lock",errno);
+    }
+    #else //__linux__
+    if(threadCpus.empty()==false ||
+       threadPolicy!=AsyncSerial::DefaultScheduling || stackLock>0)
+        failed="Thread options not available on this platform";
+    #endif //__linux__
+    if(failed.empty()) return locked;
+    lock_guard<mutex> l(errorMutex);
+    //The threads of a port have the same options, and likely failures
+    if(threadError.find(failed)!=string::npos) return locked;
+    if(threadError.empty()==false) threadError+="; ";
+    threadError+=failed;
+    return locked;
+}
+
+std::thread AsyncSerialImpl::startThread(const std::function<void ()>& loop)
+{
+    auto applied=make_shared<promise<void>>();
+    future<void> ready=applied->get_future();
+    std::thread t([this,applied,loop]{
+        void *locked=applyThreadOptions();
+        size_t size=stackLock;
+        applied->set_value();
+        loop();
+        #ifdef __linux__
+        //The stack is cached for reuse by other threads
+        if(locked) munlock(locked,size);
+        #endif //__linux__
+    });
+    ready.wait();
+    return t;
+}
+
+//
+//Class AsyncSerial
+//
+
 AsyncSerial::AsyncSerial(): pimpl(new AsyncSerialImpl)
 {
 
 }
 
+AsyncSerial::AsyncSerial(AsyncSerialService& service)
+        : pimpl(new AsyncSerialImpl(&service.pimpl->io))
+{
+
+}
+
 AsyncSerial::AsyncSerial(const std::string& devname, unsigned int baud_rate,
         asio::serial_port_base::parity opt_parity,
         asio::serial_port_base::character_size opt_csize,
@@ -93,20 +428,74 @@ void AsyncSerial::open(const std::string& devname, unsigned int baud_rate,
     if(isOpen()) close();
 
     setErrorStatus(true);//If an exception is thrown, error_ remains true
+    {
+        lock_guard<mutex> l(pimpl->errorMutex);
+        pimpl->threadError.clear();
+    }
+    pimpl->active=pimpl->backend;
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    if(pimpl->active!=AsioBackend)
+        openNative(devname,baud_rate,opt_parity,opt_csize,opt_flow,opt_stop);
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    if(pimpl->active==AsioBackend)
+        openAsio(devname,baud_rate,opt_parity,opt_csize,opt_flow,opt_stop);
+    setErrorStatus(false);//If we get here, no error
+    pimpl->opens++;
+    pimpl->open=true; //Port is now open
+}
+
+void AsyncSerial::openAsio(const std::string& devname, unsigned int baud_rate,
+        const asio::serial_port_base::parity& opt_parity,
+        const asio::serial_port_base::character_size& opt_csize,
+        const asio::serial_port_base::flow_control& opt_flow,
+        const asio::serial_port_base::stop_bits& opt_stop)
+{
     pimpl->port.open(devname);
-    pimpl->port.set_option(asio::serial_port_base::baud_rate(baud_rate));
     pimpl->port.set_option(opt_parity);
     pimpl->port.set_option(opt_csize);
     pimpl->port.set_option(opt_flow);
     pimpl->port.set_option(opt_stop);
+    //Last, as asio only knows the baud rates having a B* constant
+    #ifdef HAVE_TERMIOS2
+    boost::system::error_code ec;
+    pimpl->baudRate=setBaudRate(pimpl->port.native_handle(),baud_rate,ec);
+    if(ec)
+    {
+        boost::system::error_code ignored;
+        pimpl->port.close(ignored);
+        throw(boost::system::system_error(ec,"Can't set baud rate"));
+    }
+    #else //HAVE_TERMIOS2
+    pimpl->port.set_option(asio::serial_port_base::baud_rate(baud_rate));
+    asio::serial_port_base::baud_rate applied;
+    pimpl->port.get_option(applied);
+    pimpl->baudRate=applied.value();
+    #endif //HAVE_TERMIOS2
 
-    //This gives some work to the io_service before it is started
-    pimpl->io.post(boost::bind(&AsyncSerial::doRead, this));
+    pimpl->resetReadBuffers();
+    if(pimpl->consumerThread)
+    {
+        pimpl->readThread=pimpl->startThread(
+                boost::bind(&AsyncSerial::consumeReads, this));
+    }
 
-    thread t(boost::bind(&asio::io_service::run, &pimpl->io));
-    pimpl->backgroundThread.swap(t);
-    setErrorStatus(false);//If we get here, no error
-    pimpl->open=true; //Port is now open
+    //This gives some work to the io_service before it is started
+    pimpl->stopHandlers(false);
+    pimpl->post(boost::bind(&AsyncSerial::doRead, this));
+    //Data may have been queued while the port was closed
+    if(pimpl->writeScheduled.load())
+        pimpl->post(boost::bind(&AsyncSerial::doWrite, this));
+    if(pimpl->checkScheduled.load())
+        pimpl->post(boost::bind(&AsyncSerial::checkWriteQueue, this));
+
+    if(pimpl->ownIo)
+    {
+        if(pimpl->busyPoll==chrono::steady_clock::duration::zero())
+            pimpl->backgroundThread=pimpl->startThread(
+                    boost::bind(runIo,&pimpl->io));
+        else pimpl->backgroundThread=pimpl->startThread(
+                boost::bind(runIoBusy,&pimpl->io,pimpl->busyPoll));
+    }
 }
 
 bool AsyncSerial::isOpen() const
@@ -114,6 +503,11 @@ bool AsyncSerial::isOpen() const
     return pimpl->open;
 }
 
+unsigned int AsyncSerial::getBaudRate() const
+{
+    return pimpl->baudRate;
+}
+
 bool AsyncSerial::errorStatus() const
 {
     lock_guard<mutex> l(pimpl->errorMutex);
@@ -125,9 +519,24 @@ void AsyncSerial::close()
     if(!isOpen()) return;
 
     pimpl->open=false;
-    pimpl->io.post(boost::bind(&AsyncSerial::doClose, this));
-    pimpl->backgroundThread.join();
-    pimpl->io.reset();
+    {
+        //Writers blocked on a full write queue should not wait anymore
+        lock_guard<mutex> l(pimpl->limitMutex);
+        pimpl->limitCondition.notify_all();
+    }
+    {
+        //From now on the consumer thread won't restart reading, so nothing
+        //is posted after doClose()
+        lock_guard<mutex> l(pimpl->readMutex);
+        pimpl->readStopping=true;
+        pimpl->readWork.reset();
+        pimpl->readCondition.notify_one();
+    }
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    if(pimpl->active!=AsioBackend) closeNative();
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    if(pimpl->active==AsioBackend) closeAsio();
+    if(pimpl->readThread.joinable()) pimpl->readThread.join();
     if(errorStatus())
     {
         throw(boost::system::system_error(boost::system::error_code(),
@@ -135,32 +544,114 @@ void AsyncSerial::close()
     }
 }
 
-void AsyncSerial::write(const char *data, size_t size)
+void AsyncSerial::closeAsio()
 {
+    pimpl->post(boost::bind(&AsyncSerial::doClose, this));
+    pimpl->stopHandlers(true);
+    if(pimpl->ownIo)
     {
-        lock_guard<mutex> l(pimpl->writeQueueMutex);
-        pimpl->writeQueue.insert(pimpl->writeQueue.end(),data,data+size);
-    }
-    pimpl->io.post(boost::bind(&AsyncSerial::doWrite, this));
+        pimpl->backgroundThread.join();
+        pimpl->discardHandlers();
+    } else pimpl->waitHandlers(); //The io_service is run by other ports too
+}
+
+/**
+ * \return the exception thrown by write() with the Fail policy
+ */
+static boost::system::system_error writeQueueFull()
+{
+    return boost::system::system_error(asio::error::no_buffer_space,
+            "Write queue full");
+}
+
+void AsyncSerial::write(const char *data, size_t size)
+{
+    if(admitWrite(size,false)==false) throw(writeQueueFull());
+    writeQueued(pimpl->enqueue(WriteNode::create(data,size)));
 }
 
 void AsyncSerial::write(const std::vector<char>& data)
 {
-    {
-        lock_guard<mutex> l(pimpl->writeQueueMutex);
-        pimpl->writeQueue.insert(pimpl->writeQueue.end(),data.begin(),
-                data.end());
-    }
-    pimpl->io.post(boost::bind(&AsyncSerial::doWrite, this));
+    write(data.data(),data.size());
 }
 
 void AsyncSerial::writeString(const std::string& s)
 {
-    {
-        lock_guard<mutex> l(pimpl->writeQueueMutex);
-        pimpl->writeQueue.insert(pimpl->writeQueue.end(),s.begin(),s.end());
-    }
-    pimpl->io.post(boost::bind(&AsyncSerial::doWrite, this));
+    write(s.data(),s.size());
+}
+
+void AsyncSerial::write(std::vector<char>&& data)
+{
+    if(data.empty()) return;
+    if(admitWrite(data.size(),false)==false) throw(writeQueueFull());
+    writeQueued(pimpl->enqueue(WriteNode::create(std::move(data))));
+}
+
+void AsyncSerial::write(const std::shared_ptr<const std::vector<char>>& data)
+{
+    if(!data || data->empty()) return;
+    if(admitWrite(data->size(),false)==false) throw(writeQueueFull());
+    writeQueued(pimpl->enqueue(WriteNode::create(data,data->data(),
+            data->size())));
+}
+
+void AsyncSerial::writeString(std::string&& s)
+{
+    if(s.empty()) return;
+    if(admitWrite(s.size(),false)==false) throw(writeQueueFull());
+    writeQueued(pimpl->enqueue(WriteNode::create(std::move(s))));
+}
+
+void AsyncSerial::writeString(const std::shared_ptr<const std::string>& s)
+{
+    if(!s || s->empty()) return;
+    if(admitWrite(s->size(),false)==false) throw(writeQueueFull());
+    writeQueued(pimpl->enqueue(WriteNode::create(s,s->data(),s->size())));
+}
+
+bool AsyncSerial::tryWrite(const char *data, size_t size)
+{
+    if(admitWrite(size,true)==false) return false;
+    writeQueued(pimpl->enqueue(WriteNode::create(data,size)));
+    return true;
+}
+
+bool AsyncSerial::tryWrite(std::vector<char>&& data)
+{
+    if(data.empty()) return true;
+    if(admitWrite(data.size(),true)==false) return false;
+    writeQueued(pimpl->enqueue(WriteNode::create(std::move(data))));
+    return true;
+}
+
+bool AsyncSerial::tryWriteString(const std::string& s)
+{
+    return tryWrite(s.data(),s.size());
+}
+
+void AsyncSerial::setWriteQueueLimit(size_t highWater, size_t lowWater,
+        QueueFullPolicy policy)
+{
+    if(lowWater>highWater)
+        throw(std::invalid_argument("lowWater greater than highWater"));
+    pimpl->policy.store(policy);
+    pimpl->lowWater.store(lowWater);
+    pimpl->highWater.store(highWater);
+    //Writers blocked on the old limit may fit in the new one
+    lock_guard<mutex> l(pimpl->limitMutex);
+    pimpl->limitCondition.notify_all();
+}
+
+void AsyncSerial::setWriteQueueCallbacks(const std::function<void ()>& high,
+        const std::function<void ()>& low)
+{
+    pimpl->highWaterCallback=high;
+    pimpl->lowWaterCallback=low;
+}
+
+size_t AsyncSerial::writeQueueSize() const
+{
+    return pimpl->queuedBytes.load();
 }
 
 AsyncSerial::~AsyncSerial()
@@ -176,13 +667,143 @@ AsyncSerial::~AsyncSerial()
     }
 }
 
+void AsyncSerial::setReadBufferSize(size_t size, size_t maxSize)
+{
+    if(size==0) throw(std::invalid_argument("Read buffer size can't be 0"));
+    pimpl->readBufferMax.store(maxSize>size ? maxSize : 0);
+    pimpl->readBufferMin.store(size);
+    pimpl->readSize.store(size);
+}
+
+size_t AsyncSerial::getReadBufferSize() const
+{
+    return pimpl->readSize.load();
+}
+
+void AsyncSerial::setReadBuffers(unsigned int count, bool consumerThread)
+{
+    if(count==0) throw(std::invalid_argument("At least one read buffer"));
+    pimpl->readBufferCount=count;
+    pimpl->consumerThread=consumerThread;
+}
+
+void AsyncSerial::setBackend(Backend backend)
+{
+    #ifndef ASYNCSERIAL_NATIVE_BACKENDS
+    if(backend!=AsioBackend)
+        throw(std::invalid_argument("Backend not available"));
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    pimpl->backend=backend;
+}
+
+AsyncSerial::Backend AsyncSerial::getBackend() const
+{
+    return isOpen() ? pimpl->active : pimpl->backend;
+}
+
+void AsyncSerial::setBusyPoll(const posix_time::time_duration& t)
+{
+    if(t.is_pos_infinity())
+    {
+        pimpl->busyPoll=chrono::steady_clock::duration::max();
+        return;
+    }
+    if(t.is_special() || t.is_negative())
+        throw(std::invalid_argument("Invalid busy polling time"));
+    pimpl->busyPoll=chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::microseconds(t.total_microseconds()));
+}
+
+void AsyncSerial::setThreadAffinity(const std::vector<unsigned int>& cpus)
+{
+    pimpl->threadCpus=cpus;
+}
+
+void AsyncSerial::setThreadScheduling(SchedulingPolicy policy, int priority)
+{
+    #ifdef __linux__
+    if(policy!=DefaultScheduling)
+    {
+        int p=policy==FifoScheduling ? SCHED_FIFO : SCHED_RR;
+        if(priority<sched_get_priority_min(p) ||
+           priority>sched_get_priority_max(p))
+            throw(std::invalid_argument("Invalid real time priority"));
+    }
+    #endif //__linux__
+    pimpl->threadPolicy=policy;
+    pimpl->threadPriority=priority;
+}
+
+void AsyncSerial::setThreadStackLock(size_t size)
+{
+    pimpl->stackLock=size;
+}
+
+std::string AsyncSerial::threadOptionsError() const
+{
+    lock_guard<mutex> l(pimpl->errorMutex);
+    return pimpl->threadError;
+}
+
+AsyncSerial::Stats AsyncSerial::getStats() const
+{
+    Stats s;
+    {
+        lock_guard<mutex> l(pimpl->statsMutex);
+        pimpl->readCounters(s);
+        const Stats& base=pimpl->statsBase;
+        s.bytesReceived-=base.bytesReceived;
+        s.chunksReceived-=base.chunksReceived;
+        s.bytesSent-=base.bytesSent;
+        s.chunksSent-=base.chunksSent;
+        for(unsigned int i=0;i<Stats::histogramSize;i++)
+        {
+            s.readSizes[i]-=base.readSizes[i];
+            s.callbackTimes[i]-=base.callbackTimes[i];
+        }
+        s.errors-=base.errors;
+        s.reopens-=base.reopens;
+    }
+    s.writeQueueSize=pimpl->queuedBytes.load(memory_order_relaxed);
+    s.writeQueuePeak=pimpl->writeQueuePeak.load(memory_order_relaxed);
+
+    #ifdef __linux__
+    //Not all drivers support it, USB adapters and ptys often don't
+    int fd=-1;
+    if(isOpen()) fd=pimpl->port.native_handle();
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    if(isOpen() && pimpl->active!=AsioBackend) fd=pimpl->fd;
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    serial_icounter_struct counters;
+    if(fd>=0 && ioctl(fd,TIOCGICOUNT,&counters)==0)
+    {
+        s.driverCounters=true;
+        s.overruns=counters.overrun;
+        s.bufferOverruns=counters.buf_overrun;
+        s.frameErrors=counters.frame;
+        s.parityErrors=counters.parity;
+        s.breaks=counters.brk;
+    }
+    #endif //__linux__
+    return s;
+}
+
+void AsyncSerial::resetStats()
+{
+    lock_guard<mutex> l(pimpl->statsMutex);
+    pimpl->readCounters(pimpl->statsBase);
+    pimpl->writeQueuePeak.store(pimpl->queuedBytes.load(memory_order_relaxed),
+            memory_order_relaxed);
+}
+
 void AsyncSerial::doRead()
 {
-    pimpl->port.async_read_some(asio::buffer(pimpl->readBuffer,readBufferSize),
-            boost::bind(&AsyncSerial::readEnd,
+    pimpl->resizeReadBuffer();
+    pimpl->port.async_read_some(asio::buffer(pimpl->readBuffers[pimpl->readIndex]),
+            pimpl->wrap(boost::bind(&AsyncSerial::readEnd,
             this,
             asio::placeholders::error,
-            asio::placeholders::bytes_transferred));
+            asio::placeholders::bytes_transferred)));
 }
 
 void AsyncSerial::readEnd(const boost::system::error_code& error,
@@ -207,55 +828,162 @@ void AsyncSerial::readEnd(const boost::system::error_code& error,
             setErrorStatus(true);
         }
     } else {
-        if(pimpl->callback) pimpl->callback(pimpl->readBuffer,
-                bytes_transferred);
-        doRead();
+        pimpl->readCompleted(bytes_transferred,
+                pimpl->readBuffers[pimpl->readIndex].size());
+        if(pimpl->consumerThread)
+        {
+            if(pimpl->queueReadBuffer(bytes_transferred)) doRead();
+            return;
+        }
+        //Start the next read before calling the callback, as long as there
+        //is another buffer, so that data keeps being drained meanwhile
+        size_t completed=pimpl->readIndex;
+        pimpl->readIndex=(completed+1) % pimpl->readBuffers.size();
+        if(pimpl->readIndex!=completed) doRead();
+        pimpl->readCallback(completed,bytes_transferred);
+        if(pimpl->readIndex==completed) doRead();
+    }
+}
+
+void AsyncSerial::consumeReads()
+{
+    unique_lock<mutex> l(pimpl->readMutex);
+    for(;;)
+    {
+        while(pimpl->filledReadBuffers.empty() && !pimpl->readStopping)
+            pimpl->readCondition.wait(l);
+        if(pimpl->filledReadBuffers.empty()) return; //Stopping
+        pair<size_t,size_t> filled=pimpl->filledReadBuffers.front();
+        pimpl->filledReadBuffers.pop_front();
+        l.unlock();
+        pimpl->readCallback(filled.first,filled.second);
+        l.lock();
+        pimpl->freeReadBuffers.push_back(filled.first);
+        if(pimpl->readStalled && !pimpl->readStopping)
+        {
+            //The io_service thread ran out of buffers, restart reading
+            pimpl->readStalled=false;
+            pimpl->readIndex=pimpl->freeReadBuffers.back();
+            pimpl->freeReadBuffers.pop_back();
+            postRead();
+            pimpl->readWork.reset();
+        }
     }
 }
 
 void AsyncSerial::doWrite()
 {
     //If a write operation is already in progress, do nothing
-    if(pimpl->writeBuffer==0)
+    if(pimpl->writeBuffers.empty()==false) return;
+    pimpl->collectWrites();
+    if(pimpl->writeBuffers.empty())
     {
-        lock_guard<mutex> l(pimpl->writeQueueMutex);
-        pimpl->writeBufferSize=pimpl->writeQueue.size();
-        pimpl->writeBuffer.reset(new char[pimpl->writeQueue.size()]);
-        copy(pimpl->writeQueue.begin(),pimpl->writeQueue.end(),
-                pimpl->writeBuffer.get());
-        pimpl->writeQueue.clear();
-        async_write(pimpl->port,asio::buffer(pimpl->writeBuffer.get(),
-                pimpl->writeBufferSize),
-                boost::bind(&AsyncSerial::writeEnd, this, asio::placeholders::error));
+        pimpl->writeScheduled.exchange(false);
+        //A producer may have queued data after collectWrites() but before
+        //the flag was cleared, and not posted doWrite(), so check again.
+        //Any producer queuing data from now on posts doWrite() itself
+        pimpl->collectWrites();
+        if(pimpl->writeBuffers.empty()) return;
+        pimpl->writeScheduled.store(true);
     }
+    //All queued messages go out with a single gather write
+    const asio::const_buffer *b=pimpl->writeBuffers.data();
+    async_write(pimpl->port,BufferRange(b,b+pimpl->writeBuffers.size()),
+            pimpl->wrap(boost::bind(&AsyncSerial::writeEnd, this,
+            asio::placeholders::error)));
 }
 
 void AsyncSerial::writeEnd(const boost::system::error_code& error)
 {
     if(!error)
     {
-        lock_guard<mutex> l(pimpl->writeQueueMutex);
-        if(pimpl->writeQueue.empty())
-        {
-            pimpl->writeBuffer.reset();
-            pimpl->writeBufferSize=0;
-            
-            return;
-        }
-        pimpl->writeBufferSize=pimpl->writeQueue.size();
-        pimpl->writeBuffer.reset(new char[pimpl->writeQueue.size()]);
-        copy(pimpl->writeQueue.begin(),pimpl->writeQueue.end(),
-                pimpl->writeBuffer.get());
-        pimpl->writeQueue.clear();
-        async_write(pimpl->port,asio::buffer(pimpl->writeBuffer.get(),
-                pimpl->writeBufferSize),
-                boost::bind(&AsyncSerial::writeEnd, this, asio::placeholders::error));
+        pimpl->bytesSent.add(pimpl->inFlightBytes);
+        pimpl->chunksSent.add(1);
+    }
+    pimpl->clearWrites();
+    pimpl->checkWatermarks();
+    if(!error)
+    {
+        doWrite(); //Restart if more data has been queued meanwhile
     } else {
+        pimpl->writeScheduled.store(false); //So that writes restart if reopened
         setErrorStatus(true);
         doClose();
     }
 }
 
+bool AsyncSerial::admitWrite(size_t size, bool failFast)
+{
+    size_t high=pimpl->highWater.load(memory_order_relaxed);
+    if(high==0)
+    {
+        pimpl->queuedPeak(pimpl->queuedBytes.fetch_add(size)+size);
+        return true;
+    }
+
+    if(pimpl->policy.load(memory_order_relaxed)==DropOldest && !failFast)
+    {
+        //The io_service thread drops data to keep what is waiting within
+        //highWater. Writers don't wait for room, but if they outrun it by
+        //another highWater they wait for it to do a pass
+        size_t queued=pimpl->queuedBytes.fetch_add(size)+size;
+        pimpl->queuedPeak(queued);
+        if(queued<=2*high) return true;
+        if(pimpl->cantWait()) return true;
+        unique_lock<mutex> l(pimpl->limitMutex);
+        unsigned int generation=pimpl->dropGeneration;
+        pimpl->limitHit.store(true);
+        if(pimpl->needsCheck()) postCheck();
+        pimpl->limitWaiters++;
+        while(generation==pimpl->dropGeneration && isOpen())
+            pimpl->limitCondition.wait(l);
+        pimpl->limitWaiters--;
+        return true;
+    }
+
+    if(pimpl->reserve(size,high)) return true;
+    pimpl->limitHit.store(true); //For checkWatermarks()
+    if(failFast || pimpl->policy.load(memory_order_relaxed)==Fail) return false;
+    if(pimpl->cantWait())
+    {
+        pimpl->queuedPeak(pimpl->queuedBytes.fetch_add(size)+size);
+        return true;
+    }
+    unique_lock<mutex> l(pimpl->limitMutex);
+    pimpl->limitWaiters++;
+    while(pimpl->reserve(size,high)==false)
+    {
+        //Don't wait for a port that won't drain the queue
+        if(isOpen()==false)
+        {
+            pimpl->queuedPeak(pimpl->queuedBytes.fetch_add(size)+size);
+            break;
+        }
+        pimpl->limitCondition.wait(l);
+        high=pimpl->highWater.load(memory_order_relaxed); //May have changed
+    }
+    pimpl->limitWaiters--;
+    return true;
+}
+
+void AsyncSerial::writeQueued(bool post)
+{
+    //If a write is already scheduled, it will pick up this data as well
+    if(post) postWrite();
+    if(pimpl->needsCheck()) postCheck();
+}
+
+void AsyncSerial::checkWriteQueue()
+{
+    pimpl->checkScheduled.store(false);
+    pimpl->checkWatermarks();
+    if(pimpl->policy.load()==DropOldest)
+    {
+        pimpl->dropOldest();
+        pimpl->checkWatermarks();
+    }
+}
+
 void AsyncSerial::doClose()
 {
     boost::system::error_code ec;
@@ -265,21 +993,85 @@ void AsyncSerial::doClose()
     if(ec) setErrorStatus(true);
 }
 
+void AsyncSerial::postRead()
+{
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    if(pimpl->active!=AsioBackend)
+    {
+        pimpl->request(AsyncSerialImpl::ReadRequest);
+        return;
+    }
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    pimpl->post(boost::bind(&AsyncSerial::doRead, this));
+}
+
+void AsyncSerial::postWrite()
+{
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    if(pimpl->active!=AsioBackend)
+    {
+        //With a limit, the watermark callbacks have to be called from the
+        //epoll thread, so it does the writing. With io_uring writes are
+        //always submitted by its thread
+        if(pimpl->active==EpollBackend &&
+           pimpl->highWater.load(memory_order_relaxed)==0)
+        {
+            AsyncSerialImpl::WriteStateLock l(pimpl.get(),true);
+            if(l.ownsLock())
+            {
+                //If the port is closed, data stays queued until reopened
+                pimpl->writeLocked();
+                return;
+            }
+        }
+        pimpl->request(AsyncSerialImpl::WriteRequest);
+        return;
+    }
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    pimpl->post(boost::bind(&AsyncSerial::doWrite, this));
+}
+
+void AsyncSerial::postCheck()
+{
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    if(pimpl->active!=AsioBackend)
+    {
+        pimpl->request(AsyncSerialImpl::CheckRequest);
+        return;
+    }
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    pimpl->post(boost::bind(&AsyncSerial::checkWriteQueue, this));
+}
+
 void AsyncSerial::setErrorStatus(bool e)
 {
     lock_guard<mutex> l(pimpl->errorMutex);
+    if(e && pimpl->error==false && pimpl->open) pimpl->errors++;
     pimpl->error=e;
 }
 
 void AsyncSerial::setReadCallback(const std::function<void (const char*, size_t)>& callback)
 {
     pimpl->callback=callback;
+    std::function<void (const char*, size_t, const ReadInfo&)> empty;
+    pimpl->timedCallback.swap(empty);
+}
+
+void AsyncSerial::setTimestampedReadCallback(const std::function<void (
+        const char*, size_t, const ReadInfo&)>& callback, bool realtime)
+{
+    pimpl->realtimeStamps=realtime;
+    pimpl->timedCallback=callback;
+    std::function<void (const char*, size_t)> empty;
+    pimpl->callback.swap(empty);
 }
 
 void AsyncSerial::clearReadCallback()
 {
     std::function<void (const char*, size_t)> empty;
     pimpl->callback.swap(empty);
+    std::function<void (const char*, size_t, const ReadInfo&)> emptyTimed;
+    pimpl->timedCallback.swap(emptyTimed);
 }
 
 #else //__APPLE__
@@ -289,11 +1081,15 @@ void AsyncSerial::clearReadCallback()
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <IOKit/serial/ioss.h>
 
 class AsyncSerialImpl: private boost::noncopyable
 {
 public:
-    AsyncSerialImpl(): backgroundThread(), open(false), error(false) {}
+    AsyncSerialImpl(): backgroundThread(), open(false), error(false),
+            baudRate(0), readSize(AsyncSerial::readBufferSize),
+            realtimeStamps(false) {}
 
     boost::thread backgroundThread; ///< Thread that runs read operations
     bool open; ///< True if port open
@@ -301,11 +1097,19 @@ public:
     mutable boost::mutex errorMutex; ///< Mutex for access to error
 
     int fd; ///< File descriptor for serial port
+    unsigned int baudRate; ///< Baud rate applied by the last open()
     
-    char readBuffer[AsyncSerial::readBufferSize]; ///< data being read
+    std::vector<char> readBuffer; ///< data being read
+    std::atomic<size_t> readSize; ///< Configured read buffer size
 
     /// Read complete callback
     std::function<void (const char*, size_t)> callback;
+    /// Read complete callback with the arrival information, if set it is
+    /// called instead of callback
+    std::function<void (const char*, size_t, const AsyncSerial::ReadInfo&)>
+            timedCallback;
+    bool realtimeStamps; ///< If true, the wall clock time is taken too
+    AsyncSerial::ReadInfo readInfo; ///< Arrival information of readBuffer
 };
 
 AsyncSerial::AsyncSerial(): pimpl(new AsyncSerialImpl)
@@ -313,6 +1117,12 @@ AsyncSerial::AsyncSerial(): pimpl(new AsyncSerialImpl)
 
 }
 
+AsyncSerial::AsyncSerial(AsyncSerialService& service)
+        : pimpl(new AsyncSerialImpl)
+{
+
+}
+
 AsyncSerial::AsyncSerial(const std::string& devname, unsigned int baud_rate,
         asio::serial_port_base::parity opt_parity,
         asio::serial_port_base::character_size opt_csize,
@@ -335,6 +1145,7 @@ void AsyncSerial::open(const std::string& devname, unsigned int baud_rate,
     
     struct termios new_attributes;
     speed_t speed;
+    bool anySpeed=false;
     int status;
     
     // Open port
@@ -385,9 +1196,9 @@ void AsyncSerial::open(const std::string& devname, unsigned int baud_rate,
         case 230400:speed= B230400; break;
         default:
         {
-            ::close(pimpl->fd);
-            throw(boost::system::system_error(
-                        boost::system::error_code(),"Unsupported baud rate"));
+            //Set after tcsetattr() with IOSSIOSPEED, that takes any value
+            speed=B9600;
+            anySpeed=true;
         }
     }
 
@@ -402,6 +1213,14 @@ void AsyncSerial::open(const std::string& devname, unsigned int baud_rate,
         throw(boost::system::system_error(
                     boost::system::error_code(),"Can't set port attributes"));
     }
+    speed_t applied=baud_rate;
+    if(anySpeed && ioctl(pimpl->fd,IOSSIOSPEED,&applied)<0)
+    {
+        ::close(pimpl->fd);
+        throw(boost::system::system_error(
+                    boost::system::error_code(),"Unsupported baud rate"));
+    }
+    pimpl->baudRate=applied;
 
     //These 3 lines clear the O_NONBLOCK flag
     status=fcntl(pimpl->fd, F_GETFL, 0);
@@ -419,6 +1238,11 @@ bool AsyncSerial::isOpen() const
     return pimpl->open;
 }
 
+unsigned int AsyncSerial::getBaudRate() const
+{
+    return pimpl->baudRate;
+}
+
 bool AsyncSerial::errorStatus() const
 {
     lock_guard<mutex> l(pimpl->errorMutex);
@@ -457,6 +1281,123 @@ void AsyncSerial::writeString(const std::string& s)
     if(::write(pimpl->fd,&s[0],s.size())!=s.size()) setErrorStatus(true);
 }
 
+void AsyncSerial::write(std::vector<char>&& data)
+{
+    write(data.data(),data.size());
+}
+
+void AsyncSerial::write(const std::shared_ptr<const std::vector<char>>& data)
+{
+    if(data) write(data->data(),data->size());
+}
+
+void AsyncSerial::writeString(std::string&& s)
+{
+    write(s.data(),s.size());
+}
+
+void AsyncSerial::writeString(const std::shared_ptr<const std::string>& s)
+{
+    if(s) write(s->data(),s->size());
+}
+
+bool AsyncSerial::tryWrite(const char *data, size_t size)
+{
+    write(data,size);
+    return true;
+}
+
+bool AsyncSerial::tryWrite(std::vector<char>&& data)
+{
+    write(data.data(),data.size());
+    return true;
+}
+
+bool AsyncSerial::tryWriteString(const std::string& s)
+{
+    return tryWrite(s.data(),s.size());
+}
+
+void AsyncSerial::setWriteQueueLimit(size_t highWater, size_t lowWater,
+        QueueFullPolicy policy)
+{
+    //Writes are synchronous, nothing is ever queued
+}
+
+void AsyncSerial::setWriteQueueCallbacks(const std::function<void ()>& high,
+        const std::function<void ()>& low)
+{
+    //Writes are synchronous, nothing is ever queued
+}
+
+size_t AsyncSerial::writeQueueSize() const
+{
+    return 0;
+}
+
+void AsyncSerial::setReadBufferSize(size_t size, size_t maxSize)
+{
+    //Adaptive mode is not supported
+    if(size==0) throw(std::invalid_argument("Read buffer size can't be 0"));
+    pimpl->readSize.store(size);
+}
+
+size_t AsyncSerial::getReadBufferSize() const
+{
+    return pimpl->readSize.load();
+}
+
+void AsyncSerial::setReadBuffers(unsigned int count, bool consumerThread)
+{
+    //Not supported, reads are done by a blocking thread anyway
+}
+
+void AsyncSerial::setBackend(Backend backend)
+{
+    if(backend!=AsioBackend)
+        throw(std::invalid_argument("Backend only available on Linux"));
+}
+
+AsyncSerial::Backend AsyncSerial::getBackend() const
+{
+    return AsioBackend;
+}
+
+void AsyncSerial::setBusyPoll(const posix_time::time_duration& t)
+{
+    if(t!=posix_time::time_duration())
+        throw(std::invalid_argument("Busy polling not available"));
+}
+
+void AsyncSerial::setThreadAffinity(const std::vector<unsigned int>& cpus)
+{
+    if(cpus.empty()==false)
+        throw(std::invalid_argument("Thread options not available"));
+}
+
+void AsyncSerial::setThreadScheduling(SchedulingPolicy policy, int priority)
+{
+    if(policy!=DefaultScheduling)
+        throw(std::invalid_argument("Thread options not available"));
+}
+
+void AsyncSerial::setThreadStackLock(size_t size)
+{
+    if(size>0) throw(std::invalid_argument("Thread options not available"));
+}
+
+std::string AsyncSerial::threadOptionsError() const
+{
+    return "";
+}
+
+AsyncSerial::Stats AsyncSerial::getStats() const
+{
+    return Stats();
+}
+
+void AsyncSerial::resetStats() {}
+
 AsyncSerial::~AsyncSerial()
 {
     if(isOpen())
@@ -475,7 +1416,9 @@ void AsyncSerial::doRead()
     //Read loop in spawned thread
     for(;;)
     {
-        int received=::read(pimpl->fd,pimpl->readBuffer,readBufferSize);
+        size_t size=pimpl->readSize.load();
+        if(pimpl->readBuffer.size()!=size) vector<char>(size).swap(pimpl->readBuffer);
+        int received=::read(pimpl->fd,pimpl->readBuffer.data(),size);
         if(received<0)
         {
             if(isOpen()==false) return; //Thread interrupted because port closed
@@ -484,7 +1427,18 @@ void AsyncSerial::doRead()
                 continue;
             }
         }
-        if(pimpl->callback) pimpl->callback(pimpl->readBuffer, received);
+        if(pimpl->timedCallback)
+        {
+            AsyncSerial::ReadInfo& info=pimpl->readInfo;
+            info.monotonic=chrono::steady_clock::now();
+            if(pimpl->realtimeStamps) info.realtime=chrono::system_clock::now();
+            info.full= static_cast<size_t>(received)==size;
+            pimpl->timedCallback(pimpl->readBuffer.data(),received,info);
+            info.sequence++;
+            info.offset+=received;
+        } else if(pimpl->callback) {
+            pimpl->callback(pimpl->readBuffer.data(), received);
+        }
     }
 }
 
@@ -509,6 +1463,27 @@ void AsyncSerial::doClose()
     //Not used
 }
 
+bool AsyncSerial::admitWrite(size_t size, bool failFast)
+{
+    //Not used
+    return true;
+}
+
+void AsyncSerial::writeQueued(bool post)
+{
+    //Not used
+}
+
+void AsyncSerial::checkWriteQueue()
+{
+    //Not used
+}
+
+void AsyncSerial::consumeReads()
+{
+    //Not used
+}
+
 void AsyncSerial::setErrorStatus(bool e)
 {
     lock_guard<mutex> l(pimpl->errorMutex);
@@ -518,12 +1493,25 @@ void AsyncSerial::setErrorStatus(bool e)
 void AsyncSerial::setReadCallback(const std::function<void (const char*, size_t)>& callback)
 {
     pimpl->callback=callback;
+    std::function<void (const char*, size_t, const ReadInfo&)> empty;
+    pimpl->timedCallback.swap(empty);
+}
+
+void AsyncSerial::setTimestampedReadCallback(const std::function<void (
+        const char*, size_t, const ReadInfo&)>& callback, bool realtime)
+{
+    pimpl->realtimeStamps=realtime;
+    pimpl->timedCallback=callback;
+    std::function<void (const char*, size_t)> empty;
+    pimpl->callback.swap(empty);
 }
 
 void AsyncSerial::clearReadCallback()
 {
     std::function<void (const char*, size_t)> empty;
     pimpl->callback.swap(empty);
+    std::function<void (const char*, size_t, const ReadInfo&)> emptyTimed;
+    pimpl->timedCallback.swap(emptyTimed);
 }
 
 #endif //__APPLE__
@@ -537,6 +1525,12 @@ CallbackAsyncSerial::CallbackAsyncSerial(): AsyncSerial()
 
 }
 
+CallbackAsyncSerial::CallbackAsyncSerial(AsyncSerialService& service)
+        : AsyncSerial(service)
+{
+
+}
+
 CallbackAsyncSerial::CallbackAsyncSerial(const std::string& devname,
         unsigned int baud_rate,
         asio::serial_port_base::parity opt_parity,
@@ -553,6 +1547,12 @@ void CallbackAsyncSerial::setCallback(const std::function<void (const char*, siz
     setReadCallback(callback);
 }
 
+void CallbackAsyncSerial::setTimestampedCallback(const std::function<void (
+        const char*, size_t, const ReadInfo&)>& callback, bool realtime)
+{
+    setTimestampedReadCallback(callback,realtime);
+}
+
 void CallbackAsyncSerial::clearCallback()
 {
     clearReadCallback();
@@ -0,0 +1,368 @@
+/*
+ * File:   AsyncSerialEpoll.cpp
+ * Author: Terraneo Federico
+ * Distributed under the Boost Software License, Version 1.0.
+ *
+ * The epoll backend of AsyncSerial, Linux only. The io_uring backend in
+ * AsyncSerialUring.cpp shares how the port is opened and closed, and how
+ * queued data is turned into gather writes.
+ */
+
+#include "AsyncSerial.h"
+
+#ifdef ASYNCSERIAL_NATIVE_BACKENDS
+
+#include "AsyncSerialImpl.h"
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <boost/bind.hpp>
+#include "termios2.h"
+
+using namespace std;
+using namespace boost;
+
+//
+//Class AsyncSerialImpl
+//
+
+void AsyncSerialImpl::openFd(const std::string& devname, unsigned int baud,
+        const asio::serial_port_base::parity& parity,
+        const asio::serial_port_base::character_size& csize,
+        const asio::serial_port_base::flow_control& flow,
+        const asio::serial_port_base::stop_bits& stop)
+{
+    fd=::open(devname.c_str(),O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(fd<0) throw(boost::system::system_error(boost::system::error_code(
+            errno,boost::system::system_category()),"Failed to open port"));
+    boost::system::error_code ec;
+    termios ios;
+    if(tcgetattr(fd,&ios)<0)
+        ec.assign(errno,boost::system::system_category());
+    if(!ec)
+    {
+        cfmakeraw(&ios);
+        ios.c_iflag|=IGNPAR;
+        ios.c_cflag|=CREAD | CLOCAL;
+        #ifndef HAVE_TERMIOS2
+        asio::serial_port_base::baud_rate(baud).store(ios,ec);
+        baudRate=baud;
+        #endif //HAVE_TERMIOS2
+    }
+    if(!ec) parity.store(ios,ec);
+    if(!ec) csize.store(ios,ec);
+    if(!ec) flow.store(ios,ec);
+    if(!ec) stop.store(ios,ec);
+    if(!ec && tcsetattr(fd,TCSANOW,&ios)<0)
+        ec.assign(errno,boost::system::system_category());
+    #ifdef HAVE_TERMIOS2
+    if(!ec) baudRate=setBaudRate(fd,baud,ec);
+    #endif //HAVE_TERMIOS2
+    if(!ec && wakeFd<0)
+    {
+        //Created on first use and kept, so that request() never uses a
+        //closed file descriptor
+        wakeFd=eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+        if(wakeFd<0) ec.assign(errno,boost::system::system_category());
+    }
+    if(ec)
+    {
+        ::close(fd);
+        fd=-1;
+        throw(boost::system::system_error(ec,"Can't set up port"));
+    }
+    writeArmed=false;
+}
+
+void AsyncSerialImpl::watchFd()
+{
+    boost::system::error_code ec;
+    if(epollFd<0)
+    {
+        epollFd=epoll_create1(EPOLL_CLOEXEC);
+        epoll_event ev;
+        ev.events=EPOLLIN;
+        ev.data.fd=wakeFd;
+        if(epollFd<0 || epoll_ctl(epollFd,EPOLL_CTL_ADD,wakeFd,&ev)<0)
+        {
+            ec.assign(errno,boost::system::system_category());
+            if(epollFd>=0) ::close(epollFd);
+            epollFd=-1;
+        }
+    }
+    if(!ec)
+    {
+        epoll_event ev;
+        ev.events=EPOLLIN | EPOLLET;
+        ev.data.fd=fd;
+        if(epoll_ctl(epollFd,EPOLL_CTL_ADD,fd,&ev)<0)
+            ec.assign(errno,boost::system::system_category());
+    }
+    if(ec)
+    {
+        ::close(fd);
+        fd=-1;
+        throw(boost::system::system_error(ec,"Can't set up port"));
+    }
+}
+
+bool AsyncSerialImpl::closeFd()
+{
+    WriteStateLock l(this);
+    if(writeIovs.empty()==false) abortWrites();
+    if(active==AsyncSerial::EpollBackend)
+        epoll_ctl(epollFd,EPOLL_CTL_DEL,fd,nullptr);
+    #ifdef HAVE_IO_URING
+    if(ring)
+    {
+        //setupUring() cleared O_NONBLOCK, the other backends expect it
+        ring.reset();
+        int flags=fcntl(fd,F_GETFL);
+        if(flags>=0) fcntl(fd,F_SETFL,flags | O_NONBLOCK);
+    }
+    #endif //HAVE_IO_URING
+    bool result=::close(fd)==0;
+    fd=-1;
+    return result;
+}
+
+bool AsyncSerialImpl::epollRead()
+{
+    for(;;)
+    {
+        resizeReadBuffer();
+        std::vector<char>& buffer=readBuffers[readIndex];
+        ssize_t n=::read(fd,buffer.data(),buffer.size());
+        if(n<0)
+        {
+            if(errno==EINTR) continue;
+            return errno==EAGAIN || errno==EWOULDBLOCK;
+        }
+        if(n==0) return false; //As asio, end of file is an error
+        readCompleted(n,buffer.size());
+        if(consumerThread)
+        {
+            if(queueReadBuffer(n)) continue;
+            readPaused=true; //Until the consumer thread gives one back
+            return true;
+        }
+        readCallback(readIndex,n);
+    }
+}
+
+bool AsyncSerialImpl::prepareWrites()
+{
+    for(;;)
+    {
+        while(writeIovIndex<writeIovs.size() &&
+              writeIovs[writeIovIndex].iov_len==0) writeIovIndex++;
+        if(writeIovIndex<writeIovs.size()) return true;
+        if(writeIovs.empty()==false)
+        {
+            //The previous write is complete
+            writeIovs.clear();
+            writeIovIndex=0;
+            clearWrites();
+            checkWatermarks();
+        }
+        collectWrites();
+        if(writeBuffers.empty())
+        {
+            //Same as in doWrite()
+            writeScheduled.exchange(false);
+            collectWrites();
+            if(writeBuffers.empty()) return false;
+            writeScheduled.store(true);
+        }
+        for(const asio::const_buffer& b : writeBuffers)
+        {
+            iovec v;
+            v.iov_base=const_cast<char*>(asio::buffer_cast<const char*>(b));
+            v.iov_len=asio::buffer_size(b);
+            writeIovs.push_back(v);
+        }
+    }
+}
+
+void AsyncSerialImpl::advanceWrites(size_t written)
+{
+    bytesSent.add(written);
+    chunksSent.add(1);
+    while(written>0)
+    {
+        iovec& v=writeIovs[writeIovIndex];
+        size_t n=min(written,v.iov_len);
+        v.iov_base=static_cast<char*>(v.iov_base)+n;
+        v.iov_len-=n;
+        written-=n;
+        if(v.iov_len==0) writeIovIndex++;
+    }
+}
+
+AsyncSerialImpl::FlushResult AsyncSerialImpl::flushWrites()
+{
+    while(prepareWrites())
+    {
+        ssize_t n=::writev(fd,&writeIovs[writeIovIndex],writeIovCount());
+        if(n<0)
+        {
+            if(errno==EINTR) continue;
+            if(errno==EAGAIN || errno==EWOULDBLOCK) return Blocked;
+            return Failed;
+        }
+        advanceWrites(n);
+    }
+    return Flushed;
+}
+
+void AsyncSerialImpl::abortWrites()
+{
+    writeIovs.clear();
+    writeIovIndex=0;
+    clearWrites();
+    writeScheduled.store(false); //So that writes restart if reopened
+}
+
+void AsyncSerialImpl::writeLocked()
+{
+    if(loopRunning==false) return;
+    FlushResult result=flushWrites();
+    if(result==Failed)
+    {
+        abortWrites();
+        {
+            lock_guard<mutex> l(errorMutex);
+            if(error==false && open) errors++;
+            error=true;
+        }
+        loopRunning=false;
+        request(StopRequest);
+        return;
+    }
+    //EPOLLOUT is enabled only while needed, as it would otherwise
+    //wake the epoll thread after every write
+    bool arm= result==Blocked;
+    if(arm==writeArmed) return;
+    epoll_event ev;
+    ev.events=EPOLLIN | EPOLLET | (arm ? uint32_t(EPOLLOUT) : 0u);
+    ev.data.fd=fd;
+    epoll_ctl(epollFd,EPOLL_CTL_MOD,fd,&ev);
+    writeArmed=arm;
+}
+
+//
+//Class AsyncSerial
+//
+
+void AsyncSerial::openNative(const std::string& devname, unsigned int baud_rate,
+        const asio::serial_port_base::parity& opt_parity,
+        const asio::serial_port_base::character_size& opt_csize,
+        const asio::serial_port_base::flow_control& opt_flow,
+        const asio::serial_port_base::stop_bits& opt_stop)
+{
+    pimpl->openFd(devname,baud_rate,opt_parity,opt_csize,opt_flow,opt_stop);
+    pimpl->resetReadBuffers();
+    //Fall back to epoll if io_uring is not available
+    if(pimpl->active==UringBackend && pimpl->setupUring()==false)
+        pimpl->active=EpollBackend;
+    if(pimpl->active==EpollBackend) pimpl->watchFd();
+    if(pimpl->consumerThread)
+    {
+        pimpl->readThread=pimpl->startThread(
+                boost::bind(&AsyncSerial::consumeReads, this));
+    }
+
+    //Data may have been queued while the port was closed
+    pimpl->loopRequests.store(AsyncSerialImpl::ReadRequest |
+            AsyncSerialImpl::WriteRequest | AsyncSerialImpl::CheckRequest);
+    {
+        AsyncSerialImpl::WriteStateLock l(pimpl.get());
+        pimpl->loopRunning=true;
+    }
+    pimpl->backgroundThread=pimpl->startThread(
+            boost::bind(pimpl->active==UringBackend ?
+            &AsyncSerial::runUring : &AsyncSerial::runEpoll, this));
+}
+
+void AsyncSerial::closeNative()
+{
+    pimpl->request(AsyncSerialImpl::StopRequest);
+    pimpl->backgroundThread.join();
+    if(pimpl->closeFd()==false) setErrorStatus(true);
+}
+
+void AsyncSerial::runEpoll()
+{
+    currentIo=&pimpl->io; //So that write() knows it can't block
+    bool readable=false, writable=false;
+    const chrono::steady_clock::duration spin=pimpl->busyPoll;
+    const bool busy=spin!=chrono::steady_clock::duration::zero();
+    chrono::steady_clock::time_point spinUntil;
+    if(busy) spinUntil=spinDeadline(spin);
+    for(;;)
+    {
+        unsigned int requests=pimpl->loopRequests.exchange(0);
+        if(requests & AsyncSerialImpl::StopRequest) break;
+        if(requests & AsyncSerialImpl::ReadRequest)
+        {
+            pimpl->readPaused=false;
+            readable=true;
+        }
+        if(readable && pimpl->readPaused==false)
+        {
+            //Edge triggered, so read until there is no more data
+            readable=false;
+            if(pimpl->epollRead()==false)
+            {
+                if(isOpen()) setErrorStatus(true);
+                break;
+            }
+        }
+        if(writable || (requests & AsyncSerialImpl::WriteRequest))
+        {
+            writable=false;
+            AsyncSerialImpl::WriteStateLock l(pimpl.get());
+            pimpl->writeLocked();
+        }
+        if(requests & AsyncSerialImpl::CheckRequest)
+        {
+            AsyncSerialImpl::WriteStateLock l(pimpl.get());
+            checkWriteQueue();
+        }
+
+        //When busy polling, check for events without sleeping until none
+        //arrives for the busy polling time. Waiting for the port only,
+        //instead of epoll, would miss the write and wakeup events
+        int timeout=-1;
+        if(busy && pimpl->readPaused==false &&
+           chrono::steady_clock::now()<spinUntil) timeout=0;
+        epoll_event events[2];
+        int n=epoll_wait(pimpl->epollFd,events,2,timeout);
+        if(n<0 && errno!=EINTR)
+        {
+            setErrorStatus(true);
+            break;
+        }
+        if(busy && n>0) spinUntil=spinDeadline(spin);
+        for(int i=0;i<n;i++)
+        {
+            if(events[i].data.fd==pimpl->wakeFd)
+            {
+                uint64_t count;
+                if(::read(pimpl->wakeFd,&count,sizeof(count))<0) {}
+                continue;
+            }
+            //Errors and hangups are reported by read()
+            if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                readable=true;
+            if(events[i].events & EPOLLOUT) writable=true;
+        }
+    }
+    AsyncSerialImpl::WriteStateLock l(pimpl.get());
+    pimpl->loopRunning=false;
+}
+
+#endif //ASYNCSERIAL_NATIVE_BACKENDS
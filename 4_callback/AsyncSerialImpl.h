@@ -0,0 +1,1158 @@
+/*
+ * File:   AsyncSerialImpl.h
+ * Author: Terraneo Federico
+ * Distributed under the Boost Software License, Version 1.0.
+ *
+ * Internals of AsyncSerial shared by its source files, not meant to be
+ * included by users of the class. On Mac OS X AsyncSerial.cpp has its own
+ * implementation instead.
+ */
+
+#ifndef ASYNCSERIALIMPL_H
+#define	ASYNCSERIALIMPL_H
+
+#include "AsyncSerial.h"
+
+#ifndef __APPLE__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <cstring>
+
+#ifdef ASYNCSERIAL_NATIVE_BACKENDS
+#include <climits>
+#include <sys/uio.h>
+#include "Uring.h"
+#endif //ASYNCSERIAL_NATIVE_BACKENDS
+
+/// The io_service run by the calling thread, if it is a background thread
+extern thread_local boost::asio::io_service *currentIo;
+
+/**
+ * \param spin busy polling time, duration::max() to never stop
+ * \return when busy polling starting now ends
+ */
+std::chrono::steady_clock::time_point spinDeadline(
+        std::chrono::steady_clock::duration spin);
+
+class WriteNodeBlock;
+class WriteNodeReleaser;
+
+/**
+ * A message in the write queue. Each call to write() produces one node, and
+ * a node is always sent as a whole, so messages written concurrently by
+ * different threads never interleave.
+ * The node header is kept small, as while the serial port is slower than the
+ * producers there is one node per queued write
+ */
+class WriteNode: private boost::noncopyable
+{
+public:
+    enum Kind
+    {
+        Inline, ///< Data copied right after the node, in the same allocation
+        Vector, ///< A vector moved into the queue
+        String, ///< A string moved into the queue
+        Shared  ///< A shared buffer, kept alive until it has been written
+    };
+
+    /**
+     * Build a node with a copy of the data
+     */
+    static WriteNode *create(const char *data, size_t size);
+
+    static WriteNode *create(std::vector<char>&& v);
+
+    static WriteNode *create(std::string&& s);
+
+    static WriteNode *create(std::shared_ptr<const void> owner,
+            const char *data, size_t size);
+
+    static void destroy(WriteNode *node);
+
+    /**
+     * Same as destroy(node), but for nodes carved out of a block, releasing
+     * the block is deferred to releaser
+     */
+    static void destroy(WriteNode *node, WriteNodeReleaser& releaser);
+
+    /// Only used by WriteQueue for its stub node
+    WriteNode(): next(nullptr), kind(Inline), size(0), block(nullptr) {}
+
+    /**
+     * \return the message data
+     */
+    const char *data() const;
+
+    std::atomic<WriteNode*> next; ///< Used by WriteQueue
+    const Kind kind;
+    const size_t size; ///< Message size
+    /// Block the node was carved from, or nullptr if allocated on its own
+    WriteNodeBlock * const block;
+
+protected:
+    WriteNode(Kind kind, size_t size, WriteNodeBlock *block=nullptr)
+            : next(nullptr), kind(kind), size(size), block(block) {}
+};
+
+/**
+ * Small Inline nodes are carved out of blocks owned by the producer thread
+ * with a bump pointer. This way write() usually does not call the allocator,
+ * and consecutive writes from a thread are contiguous in memory, so that the
+ * io_service thread walks the queue sequentially.
+ * A block is reference counted and freed when it is no longer the current
+ * block of its thread and all its nodes have been written. The count starts
+ * from a bias, corrected when the block is retired, so that the producer
+ * does not need an atomic operation per node
+ */
+class WriteNodeBlock: private boost::noncopyable
+{
+public:
+    static const size_t blockSize=65536;
+    /// Larger messages are allocated on their own
+    static const size_t maxNodeSize=blockSize/16;
+
+    /**
+     * \return storage for a node of the given total size, in the current
+     * block of the calling thread
+     */
+    static void *allocate(size_t nodeSize, WriteNodeBlock *& block)
+    {
+        nodeSize=(nodeSize+alignof(WriteNode)-1) & ~(alignof(WriteNode)-1);
+        WriteNodeBlock *b=current.block;
+        if(b==nullptr || b->used+nodeSize>blockSize)
+        {
+            if(b) b->retire();
+            b=new WriteNodeBlock;
+            current.block=b;
+        }
+        b->nodes++;
+        void *result=b->data+b->used;
+        b->used+=nodeSize;
+        block=b;
+        return result;
+    }
+
+    /**
+     * Drop references to the block, freeing it if they were the last ones
+     */
+    void release(size_t count)
+    {
+        if(refs.fetch_sub(count,std::memory_order_acq_rel)==count) delete this;
+    }
+
+private:
+    WriteNodeBlock(): refs(bias), nodes(0), used(0) {}
+
+    /**
+     * Called by the producer thread when it stops using the block
+     */
+    void retire()
+    {
+        release(bias-nodes);
+    }
+
+    /// Initial reference count, larger than any possible number of nodes
+    static const size_t bias=blockSize;
+
+    /**
+     * Releases the current block when the thread terminates
+     */
+    class Current
+    {
+    public:
+        Current(): block(nullptr) {}
+        ~Current() { if(block) block->retire(); }
+        WriteNodeBlock *block;
+    };
+
+    static thread_local Current current;
+
+    std::atomic<size_t> refs;
+    size_t nodes; ///< Nodes carved so far, only accessed by the producer
+    size_t used;  ///< Bytes carved so far, only accessed by the producer
+    alignas(WriteNode) char data[blockSize];
+};
+
+/**
+ * Gives back nodes to their block, merging consecutive nodes of the same
+ * block into a single atomic operation
+ */
+class WriteNodeReleaser: private boost::noncopyable
+{
+public:
+    WriteNodeReleaser(): block(nullptr), count(0) {}
+
+    void release(WriteNodeBlock *b)
+    {
+        if(b!=block)
+        {
+            if(block) block->release(count);
+            block=b;
+            count=0;
+        }
+        count++;
+    }
+
+    ~WriteNodeReleaser()
+    {
+        if(block) block->release(count);
+    }
+
+private:
+    WriteNodeBlock *block;
+    size_t count;
+};
+
+/**
+ * Lock free intrusive multiple producer single consumer queue of WriteNode.
+ * push() can be called by any thread, pop() only by the io_service thread.
+ * Producers only do an atomic exchange and a store, so they never wait for
+ * each other nor for the consumer.
+ * Based on Dmitry Vyukov's intrusive MPSC node based queue
+ */
+class WriteQueue: private boost::noncopyable
+{
+public:
+    WriteQueue(): head(&stub), tail(&stub) {}
+
+    void push(WriteNode *node)
+    {
+        node->next.store(nullptr,std::memory_order_relaxed);
+        WriteNode *prev=head.exchange(node,std::memory_order_acq_rel);
+        //Between the exchange and this store the queue is momentarily
+        //unlinked, pop() sees it as empty up to this node
+        prev->next.store(node,std::memory_order_release);
+    }
+
+    /**
+     * \return the oldest node, or nullptr if the queue is empty or the
+     * oldest node is still being pushed
+     */
+    WriteNode *pop()
+    {
+        WriteNode *t=tail;
+        WriteNode *next=t->next.load(std::memory_order_acquire);
+        if(t==&stub)
+        {
+            if(next==nullptr) return nullptr;
+            tail=next;
+            t=next;
+            next=next->next.load(std::memory_order_acquire);
+        }
+        if(next)
+        {
+            tail=next;
+            return t;
+        }
+        if(t!=head.load(std::memory_order_acquire)) return nullptr;
+        //t is the last node, put the stub behind it so it can be removed
+        push(&stub);
+        next=t->next.load(std::memory_order_acquire);
+        if(next==nullptr) return nullptr;
+        tail=next;
+        return t;
+    }
+
+    ~WriteQueue()
+    {
+        while(WriteNode *node=pop()) WriteNode::destroy(node);
+    }
+
+private:
+    std::atomic<WriteNode*> head; ///< Last pushed node
+    WriteNode *tail; ///< Next node to pop, accessed by the consumer only
+    WriteNode stub; ///< Keeps the queue never empty
+};
+
+/**
+ * FIFO of nodes already popped from WriteQueue, linked through next.
+ * Only used by the io_service thread
+ */
+class WriteNodeList: private boost::noncopyable
+{
+public:
+    WriteNodeList(): first(nullptr), last(nullptr) {}
+
+    void push(WriteNode *node)
+    {
+        node->next.store(nullptr,std::memory_order_relaxed);
+        if(last) last->next.store(node,std::memory_order_relaxed);
+        else first=node;
+        last=node;
+    }
+
+    /**
+     * \return the oldest node without removing it, or nullptr if empty
+     */
+    WriteNode *front() const
+    {
+        return first;
+    }
+
+    WriteNode *pop()
+    {
+        WriteNode *result=first;
+        if(result==nullptr) return nullptr;
+        first=result->next.load(std::memory_order_relaxed);
+        if(first==nullptr) last=nullptr;
+        return result;
+    }
+
+    ~WriteNodeList()
+    {
+        while(WriteNode *node=pop()) WriteNode::destroy(node);
+    }
+
+private:
+    WriteNode *first, *last;
+};
+
+/**
+ * A counter of the statistics of a port. It is incremented by one thread
+ * at a time, so a relaxed load and store are enough, without the cost of
+ * an atomic read-modify-write
+ */
+class StatCounter
+{
+public:
+    StatCounter(): value(0) {}
+
+    void add(uint64_t n)
+    {
+        value.store(value.load(std::memory_order_relaxed)+n,
+                std::memory_order_relaxed);
+    }
+
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value;
+};
+
+/**
+ * \return the bucket of a value in the histograms of AsyncSerial::Stats
+ */
+inline unsigned int histogramBucket(uint64_t value)
+{
+    #ifdef __GNUC__
+    unsigned int bucket= value==0 ? 0 : 63-__builtin_clzll(value);
+    #else //__GNUC__
+    unsigned int bucket=0;
+    while(value>1)
+    {
+        value>>=1;
+        bucket++;
+    }
+    #endif //__GNUC__
+    return std::min(bucket,AsyncSerial::Stats::histogramSize-1);
+}
+
+class AsyncSerialImpl: private boost::noncopyable
+{
+public:
+    explicit AsyncSerialImpl(boost::asio::io_service *sharedIo=nullptr)
+            : ownIo(sharedIo ? nullptr : new boost::asio::io_service),
+            io(sharedIo ? *sharedIo : *ownIo), strand(io), port(io),
+            backgroundThread(), pendingHandlers(0), handlersStopped(true),
+            discarding(false), open(false),
+            error(false), writeScheduled(false), queuedBytes(0),
+            inFlightBytes(0), highWater(0), lowWater(0),
+            policy(AsyncSerial::Block), limitWaiters(0), dropGeneration(0),
+            limitHit(false),
+            checkScheduled(false), aboveHighWater(false),
+            readBufferMin(AsyncSerial::readBufferSize), readBufferMax(0),
+            readSize(AsyncSerial::readBufferSize), fullReads(0),
+            sparseReads(0), readBufferCount(2), consumerThread(false),
+            readIndex(0), readStalled(false), readStopping(false),
+            realtimeStamps(false), readSequence(0), readOffset(0), baudRate(0),
+            backend(AsyncSerial::AsioBackend), active(AsyncSerial::AsioBackend),
+            busyPoll(std::chrono::steady_clock::duration::zero()),
+            threadPolicy(AsyncSerial::DefaultScheduling), threadPriority(0),
+            stackLock(0)
+    {
+        writeQueuePeak.store(0);
+        errors.store(0);
+        opens.store(0);
+        #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+        fd=epollFd=wakeFd=-1;
+        loopRequests.store(0);
+        loopRunning=false;
+        readPaused=false;
+        writeArmed=false;
+        writeIovIndex=0;
+        #ifdef HAVE_IO_URING
+        fixedBuffers=false;
+        #endif //HAVE_IO_URING
+        #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    }
+
+    /**
+     * Add size to queuedBytes if the result does not exceed high, or the
+     * queue is empty, as otherwise a message larger than the limit could
+     * never be sent. A high of 0 means no limit
+     */
+    bool reserve(size_t size, size_t high)
+    {
+        size_t queued=queuedBytes.load();
+        do {
+            if(high!=0 && queued!=0 && queued+size>high) return false;
+        } while(!queuedBytes.compare_exchange_weak(queued,queued+size));
+        queuedPeak(queued+size);
+        return true;
+    }
+
+    /**
+     * Update the write queue peak after data was queued
+     * \param queued queue size
+     */
+    void queuedPeak(size_t queued)
+    {
+        size_t peak=writeQueuePeak.load(std::memory_order_relaxed);
+        while(queued>peak && !writeQueuePeak.compare_exchange_weak(peak,
+                queued,std::memory_order_relaxed)) ;
+    }
+
+    /**
+     * Copy the counters of the statistics, as they are since the port was
+     * constructed, to s
+     */
+    void readCounters(AsyncSerial::Stats& s) const
+    {
+        s.bytesReceived=bytesReceived.get();
+        s.chunksReceived=chunksReceived.get();
+        s.bytesSent=bytesSent.get();
+        s.chunksSent=chunksSent.get();
+        for(unsigned int i=0;i<AsyncSerial::Stats::histogramSize;i++)
+        {
+            s.readSizes[i]=readSizes[i].get();
+            s.callbackTimes[i]=callbackTimes[i].get();
+        }
+        s.errors=errors.load(std::memory_order_relaxed);
+        s.reopens=std::max<uint64_t>(opens.load(std::memory_order_relaxed),1)-1;
+    }
+
+    /**
+     * Call the read callback, timing it for the statistics
+     * \param index read buffer holding the data
+     * \param size number of bytes read
+     */
+    void readCallback(size_t index, size_t size)
+    {
+        if(!callback && !timedCallback) return;
+        const char *data=readBuffers[index].data();
+        std::chrono::steady_clock::time_point start=
+                std::chrono::steady_clock::now();
+        if(timedCallback) timedCallback(data,size,readInfos[index]);
+        else callback(data,size);
+        std::chrono::nanoseconds t=std::chrono::steady_clock::now()-start;
+        callbackTimes[histogramBucket(t.count())].add(1);
+    }
+
+    /**
+     * Called when queued data has been written or dropped
+     */
+    void unqueued(size_t size)
+    {
+        queuedBytes.fetch_sub(size);
+        if(limitWaiters.load()>0)
+        {
+            std::lock_guard<std::mutex> l(limitMutex);
+            limitCondition.notify_all();
+        }
+    }
+
+    /**
+     * Append a message to the write queue
+     * \return true if the caller has to post doWrite()
+     */
+    bool enqueue(WriteNode *node)
+    {
+        writeQueue.push(node);
+        return writeScheduled.exchange(true)==false;
+    }
+
+    /**
+     * \return true if the caller has to post checkWriteQueue()
+     */
+    bool needsCheck()
+    {
+        size_t high=highWater.load(std::memory_order_relaxed);
+        if(high==0) return false;
+        if(queuedBytes.load(std::memory_order_relaxed)<high &&
+           limitHit.load(std::memory_order_relaxed)==false) return false;
+        return checkScheduled.exchange(true)==false;
+    }
+
+    /**
+     * \return true if the calling thread can't wait for room in the queue,
+     * because the port is closed and won't drain it, or because it is an
+     * io_service thread that makes room, for example in the read callback
+     */
+    bool cantWait() const
+    {
+        return open==false || currentIo==&io;
+    }
+
+    /**
+     * Wraps a handler so that it is accounted as pending until it has run
+     */
+    template<typename Handler>
+    class CountedHandler
+    {
+    public:
+        CountedHandler(AsyncSerialImpl *impl, const Handler& handler)
+                : impl(impl), handler(handler) {}
+
+        template<typename... Args>
+        void operator()(Args&&... args)
+        {
+            if(impl->discarding==false) handler(std::forward<Args>(args)...);
+            impl->handlerDone();
+        }
+
+    private:
+        AsyncSerialImpl *impl;
+        Handler handler;
+    };
+
+    /**
+     * Post a handler to the strand of this port, or directly to io if it is
+     * run by backgroundThread only. Does nothing while the port is closed,
+     * as nothing would wait for the handler to run
+     */
+    template<typename Handler>
+    void post(const Handler& handler)
+    {
+        std::lock_guard<std::mutex> l(handlerMutex);
+        if(handlersStopped) return;
+        pendingHandlers++;
+        if(ownIo) io.post(CountedHandler<Handler>(this,handler));
+        else strand.post(CountedHandler<Handler>(this,handler));
+    }
+
+    /**
+     * Wrap the completion handler of an asynchronous operation so that it
+     * runs in the strand of this port
+     */
+    template<typename Handler>
+    auto wrap(const Handler& handler)
+            -> decltype(std::declval<boost::asio::io_service::strand&>().wrap(
+               std::declval<CountedHandler<Handler>>()))
+    {
+        std::lock_guard<std::mutex> l(handlerMutex);
+        pendingHandlers++;
+        return strand.wrap(CountedHandler<Handler>(this,handler));
+    }
+
+    /**
+     * Called when a handler has run
+     */
+    void handlerDone()
+    {
+        std::lock_guard<std::mutex> l(handlerMutex);
+        if(--pendingHandlers==0) handlerCondition.notify_all();
+    }
+
+    /**
+     * Allow or forbid posting handlers
+     * \param stop true to forbid it
+     */
+    void stopHandlers(bool stop)
+    {
+        std::lock_guard<std::mutex> l(handlerMutex);
+        handlersStopped=stop;
+    }
+
+    /**
+     * Dequeue the handlers left in ownIo without running them. They are left
+     * if the io_service ran out of work before running them, as after an
+     * error, and would otherwise run on the reopened port.
+     * Only called when backgroundThread has stopped
+     */
+    void discardHandlers()
+    {
+        discarding=true;
+        io.reset();
+        io.poll();
+        io.reset();
+        discarding=false;
+    }
+
+    /**
+     * Wait until all handlers have run
+     */
+    void waitHandlers()
+    {
+        std::unique_lock<std::mutex> l(handlerMutex);
+        while(pendingHandlers!=0) handlerCondition.wait(l);
+    }
+
+    /**
+     * Move nodes from the lock free queue to pendingWrites.
+     * Called by the io_service thread only
+     */
+    void drainQueue()
+    {
+        while(WriteNode *node=writeQueue.pop()) pendingWrites.push(node);
+    }
+
+    /**
+     * Drop the oldest messages not yet being written until those waiting
+     * are back within the limit. Called by the io_service thread only
+     */
+    void dropOldest()
+    {
+        size_t high=highWater.load(std::memory_order_relaxed);
+        if(high==0) return;
+        drainQueue();
+        WriteNodeReleaser releaser;
+        size_t dropped=0;
+        //Data being written can't be dropped, and does not count
+        while(queuedBytes.load()-inFlightBytes-dropped>high)
+        {
+            WriteNode *node=pendingWrites.pop();
+            if(node==nullptr) break;
+            dropped+=node->size;
+            WriteNode::destroy(node,releaser);
+        }
+        if(dropped) unqueued(dropped);
+        //Writers waiting for this pass can go on
+        std::lock_guard<std::mutex> l(limitMutex);
+        dropGeneration++;
+        limitCondition.notify_all();
+    }
+
+    /**
+     * Call the watermark callbacks if the queue crossed a watermark, that is
+     * if it reached the limit or a message did not fit, and then if it went
+     * back to the low watermark. Called by the io_service thread only
+     */
+    void checkWatermarks()
+    {
+        size_t high=highWater.load(std::memory_order_relaxed);
+        if(high==0) return;
+        bool hit=limitHit.exchange(false);
+        size_t queued=queuedBytes.load();
+        if(aboveHighWater==false && (queued>=high || hit))
+        {
+            aboveHighWater=true;
+            if(highWaterCallback) highWaterCallback();
+        } else if(aboveHighWater &&
+                  queued<=lowWater.load(std::memory_order_relaxed)) {
+            aboveHighWater=false;
+            if(lowWaterCallback) lowWaterCallback();
+        }
+    }
+
+    /**
+     * Move messages in the write queue to writeBuffers.
+     * Small messages are copied into writeBuffer and their nodes freed, so
+     * that a burst of small writes still goes out with a few syscalls, large
+     * ones are referenced and kept in writeBufferNodes until written.
+     * If the queue is bounded, at least one message and at most highWater
+     * bytes are collected, so that DropOldest has something left to drop.
+     * Called by the io_service thread only
+     */
+    void collectWrites()
+    {
+        WriteNodeReleaser releaser;
+        drainQueue();
+        size_t high=highWater.load(std::memory_order_relaxed);
+        while(WriteNode *node=pendingWrites.front())
+        {
+            if(high!=0 && inFlightBytes!=0 && inFlightBytes+node->size>high)
+                break;
+            pendingWrites.pop();
+            inFlightBytes+=node->size;
+            if(node->size<=writeCopyThreshold)
+            {
+                //Consecutive copied messages are merged in a single buffer
+                if(writeRanges.empty() || writeRanges.back().node)
+                    writeRanges.push_back(WriteRange(nullptr,writeBuffer.size()));
+                writeBuffer.insert(writeBuffer.end(),node->data(),
+                        node->data()+node->size);
+                writeRanges.back().size+=node->size;
+                WriteNode::destroy(node,releaser);
+            } else {
+                writeRanges.push_back(WriteRange(node,0));
+                writeRanges.back().size=node->size;
+                writeBufferNodes.push_back(node);
+            }
+        }
+        //writeBuffer is complete, so pointers into it are now stable
+        for(const WriteRange& range : writeRanges)
+        {
+            const char *p=range.node ? range.node->data() :
+                    writeBuffer.data()+range.offset;
+            writeBuffers.push_back(boost::asio::buffer(p,range.size));
+        }
+        writeRanges.clear();
+    }
+
+    /**
+     * Release the data of a completed write
+     */
+    void clearWrites()
+    {
+        if(inFlightBytes) unqueued(inFlightBytes);
+        inFlightBytes=0;
+        WriteNodeReleaser releaser;
+        for(WriteNode *node : writeBufferNodes)
+            WriteNode::destroy(node,releaser);
+        writeBufferNodes.clear(); //Clearing vectors keeps their capacity
+        writeBuffer.clear();
+        writeBuffers.clear();
+    }
+
+    ~AsyncSerialImpl()
+    {
+        clearWrites();
+        #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+        if(epollFd>=0) ::close(epollFd);
+        if(wakeFd>=0) ::close(wakeFd);
+        #endif //ASYNCSERIAL_NATIVE_BACKENDS
+    }
+
+    /**
+     * Resize the buffer at readIndex according to nextReadSize().
+     * Called by the io_service thread only, before starting a read
+     */
+    void resizeReadBuffer()
+    {
+        std::vector<char>& readBuffer=readBuffers[readIndex];
+        size_t size=nextReadSize();
+        //Shrinking reallocates as well, to give the memory back
+        if(readBuffer.size()!=size) std::vector<char>(size).swap(readBuffer);
+    }
+
+    /**
+     * \return the size of the next read, according to the configured size
+     * and, in adaptive mode, to how full the last reads were
+     */
+    size_t nextReadSize()
+    {
+        size_t lo=readBufferMin.load(std::memory_order_relaxed);
+        size_t hi=std::max(lo,readBufferMax.load(std::memory_order_relaxed));
+        size_t size=readSize.load(std::memory_order_relaxed);
+        if(fullReads>=growAfter)
+        {
+            size*=2;
+            fullReads=0;
+        } else if(sparseReads>=shrinkAfter) {
+            size/=2;
+            sparseReads=0;
+        }
+        size=std::min(std::max(size,lo),hi);
+        readSize.store(size,std::memory_order_relaxed);
+        return size;
+    }
+
+    /**
+     * Update the statistics the adaptive mode is based on
+     * \param bytes bytes returned by the last read
+     * \param capacity bytes the last read could return
+     */
+    void readCompleted(size_t bytes, size_t capacity)
+    {
+        if(timedCallback)
+        {
+            //As close as possible to when the read returned
+            AsyncSerial::ReadInfo& info=readInfos[readIndex];
+            info.monotonic=std::chrono::steady_clock::now();
+            if(realtimeStamps) info.realtime=std::chrono::system_clock::now();
+            info.sequence=readSequence;
+            info.offset=readOffset;
+            info.full= bytes==capacity;
+        }
+        readSequence++;
+        readOffset+=bytes;
+        bytesReceived.add(bytes);
+        chunksReceived.add(1);
+        readSizes[histogramBucket(bytes)].add(1);
+        if(readBufferMax.load(std::memory_order_relaxed)==0) return;
+        if(bytes==capacity)
+        {
+            //Data was probably left in the kernel buffer
+            fullReads++;
+            sparseReads=0;
+        } else if(bytes<=capacity/sparseFraction) {
+            sparseReads++;
+            fullReads=0;
+        } else {
+            fullReads=0;
+            sparseReads=0;
+        }
+    }
+
+    /**
+     * Set up the read buffers before the port is opened
+     */
+    void resetReadBuffers()
+    {
+        readBuffers.resize(readBufferCount);
+        readInfos.assign(readBufferCount,AsyncSerial::ReadInfo());
+        readSequence=0;
+        readOffset=0;
+        readIndex=0;
+        freeReadBuffers.clear();
+        for(size_t i=1;i<readBuffers.size();i++) freeReadBuffers.push_back(i);
+        filledReadBuffers.clear();
+        readStalled=false;
+        readStopping=false;
+        readWork.reset();
+    }
+
+    /**
+     * In consumer thread mode, hand the buffer just read to the consumer
+     * thread and switch to a free one.
+     * Called by the io_service thread only
+     * \return false if there are no free buffers, reading stalls until the
+     * consumer thread gives one back
+     */
+    bool queueReadBuffer(size_t bytes)
+    {
+        std::lock_guard<std::mutex> l(readMutex);
+        filledReadBuffers.push_back(std::make_pair(readIndex,bytes));
+        readCondition.notify_one();
+        if(freeReadBuffers.empty())
+        {
+            //With no read pending the io_service would run out of work
+            readStalled=true;
+            readWork.reset(new boost::asio::io_service::work(io));
+            return false;
+        }
+        readIndex=freeReadBuffers.back();
+        freeReadBuffers.pop_back();
+        return true;
+    }
+
+    /**
+     * Apply the thread options to the calling thread. Those that fail are
+     * skipped and added to threadError
+     * \return the locked part of the stack, nullptr if none
+     */
+    void *applyThreadOptions();
+
+    /**
+     * Start a thread of the port with the thread options applied. Returns
+     * once they are, so that threadError is up to date
+     * \param loop what the thread runs
+     * \return the thread
+     */
+    std::thread startThread(const std::function<void ()>& loop);
+
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    /// Requests to the epoll loop
+    enum
+    {
+        ReadRequest=1,  ///< Read, also resumes reading if paused
+        WriteRequest=2, ///< Write queued data
+        CheckRequest=4, ///< Call checkWriteQueue()
+        StopRequest=8   ///< Exit the loop
+    };
+
+    /// Result of flushWrites()
+    enum FlushResult
+    {
+        Flushed, ///< Nothing left to write
+        Blocked, ///< The port can't take more data now
+        Failed   ///< Write error
+    };
+
+    /**
+     * Locks writeStateMutex, which with the epoll backend protects the
+     * write state as it is accessed both by the epoll thread and by threads
+     * calling write(). The owner is recorded so that a write() from a
+     * watermark callback does not try to lock it again
+     */
+    class WriteStateLock: private boost::noncopyable
+    {
+    public:
+        /**
+         * \param impl port to lock
+         * \param tryOnly if true don't wait, see ownsLock()
+         */
+        WriteStateLock(AsyncSerialImpl *impl, bool tryOnly=false)
+                : impl(impl), locked(false)
+        {
+            if(impl->writeStateOwner.load()==std::this_thread::get_id()) return;
+            if(tryOnly) locked=impl->writeStateMutex.try_lock();
+            else {
+                impl->writeStateMutex.lock();
+                locked=true;
+            }
+            if(locked) impl->writeStateOwner.store(std::this_thread::get_id());
+        }
+
+        /**
+         * \return true if the lock was taken
+         */
+        bool ownsLock() const { return locked; }
+
+        ~WriteStateLock()
+        {
+            if(locked==false) return;
+            impl->writeStateOwner.store(std::thread::id());
+            impl->writeStateMutex.unlock();
+        }
+
+    private:
+        AsyncSerialImpl *impl;
+        bool locked;
+    };
+
+    /**
+     * Ask the epoll loop to do something, waking it up if needed
+     * \param what a combination of the request flags
+     */
+    void request(unsigned int what)
+    {
+        //If other flags are set, the loop has already been woken up
+        if(loopRequests.fetch_or(what)!=0) return;
+        uint64_t one=1;
+        if(::write(wakeFd,&one,sizeof(one))<0) {} //Can only fail if the
+                                                  //counter is already set
+    }
+
+    /**
+     * Open the serial port for the epoll or io_uring backend, applying the
+     * same defaults as asio
+     * \throws boost::system::system_error on failure
+     */
+    void openFd(const std::string& devname, unsigned int baud,
+            const boost::asio::serial_port_base::parity& parity,
+            const boost::asio::serial_port_base::character_size& csize,
+            const boost::asio::serial_port_base::flow_control& flow,
+            const boost::asio::serial_port_base::stop_bits& stop);
+
+    /**
+     * Add the port opened by openFd() to the epoll instance
+     * \throws boost::system::system_error on failure, closing the port
+     */
+    void watchFd();
+
+    /**
+     * Set up the io_uring backend for the port opened by openFd(), must be
+     * called after resetReadBuffers()
+     * \return false if io_uring is not available
+     */
+    bool setupUring();
+
+    /**
+     * Close the port opened by openFd(), after the backend thread exited.
+     * A write that was in progress is abandoned, queued data is kept
+     * \return false on error
+     */
+    bool closeFd();
+
+    /**
+     * Read until the port has no more data, or until all buffers are
+     * waiting for the consumer thread. Called by the epoll thread only
+     * \return false on error
+     */
+    bool epollRead();
+
+    /**
+     * Point writeIovs at the data to write next, that is what is left of
+     * the current gather write or else a new batch from the write queue.
+     * Called by the thread doing the writing only
+     * \return false if there is nothing to write, writeScheduled is then
+     * cleared
+     */
+    bool prepareWrites();
+
+    /**
+     * \return the number of writeIovs entries to pass to the next write
+     */
+    int writeIovCount() const
+    {
+        return std::min<size_t>(writeIovs.size()-writeIovIndex,IOV_MAX);
+    }
+
+    /**
+     * Skip data that has been written, the last buffer may be partial
+     * \param written bytes written
+     */
+    void advanceWrites(size_t written);
+
+    /**
+     * Write as much queued data as the port takes, with gather writes.
+     * writeStateMutex must be locked
+     */
+    FlushResult flushWrites();
+
+    /**
+     * Drop the write in progress, writeStateMutex must be locked
+     */
+    void abortWrites();
+
+    /**
+     * Write as much as possible, and wait for the port to become writable
+     * if it can't take everything. writeStateMutex must be locked
+     */
+    void writeLocked();
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+
+    /// Messages up to this size are copied instead of referenced when
+    /// collected for writing
+    static const size_t writeCopyThreshold=512;
+
+    /// In adaptive mode, the read buffer doubles after this many
+    /// consecutive reads that filled it
+    static const unsigned int growAfter=2;
+    /// and halves after this many consecutive reads that filled less than
+    /// 1/sparseFraction of it. Shrinking is slower to avoid oscillations
+    static const unsigned int shrinkAfter=64;
+    static const size_t sparseFraction=8;
+
+    /// Io service object, unless the port uses an AsyncSerialService
+    std::unique_ptr<boost::asio::io_service> ownIo;
+    boost::asio::io_service& io; ///< Io service object, own or shared
+    /// Runs the handlers of this port one at a time, even if io is run by
+    /// many threads
+    boost::asio::io_service::strand strand;
+    boost::asio::serial_port port; ///< Serial port object
+    /// Thread that runs read/write operations, if io is ownIo
+    std::thread backgroundThread;
+    size_t pendingHandlers; ///< Handlers posted or wrapped and not yet run
+    bool handlersStopped; ///< True if post() does nothing
+    bool discarding; ///< True while discardHandlers() runs
+    std::mutex handlerMutex; ///< Protects pendingHandlers, handlersStopped
+    std::condition_variable handlerCondition;
+    bool open; ///< True if port open
+    bool error; ///< Error flag
+    mutable std::mutex errorMutex; ///< Mutex for access to error
+
+    WriteQueue writeQueue; ///< Data are queued here before being written
+    /// Nodes popped from writeQueue but not yet written
+    WriteNodeList pendingWrites;
+    /// True if doWrite() has been posted or a write is in progress, so that
+    /// there's no need to post it again
+    std::atomic<bool> writeScheduled;
+
+    /// Bytes queued or being written
+    std::atomic<size_t> queuedBytes;
+    size_t inFlightBytes; ///< Bytes being written
+    std::atomic<size_t> highWater; ///< Write queue limit, 0 if unbounded
+    std::atomic<size_t> lowWater;
+    std::atomic<AsyncSerial::QueueFullPolicy> policy;
+    /// Used by writers blocked by the Block policy
+    std::mutex limitMutex;
+    std::condition_variable limitCondition;
+    std::atomic<int> limitWaiters;
+    unsigned int dropGeneration; ///< Count of dropOldest() passes
+    /// Set when a message did not fit in the queue
+    std::atomic<bool> limitHit;
+    /// True if checkWriteQueue() has been posted
+    std::atomic<bool> checkScheduled;
+    /// True if the high watermark callback was the last one called
+    bool aboveHighWater;
+    std::function<void ()> highWaterCallback;
+    std::function<void ()> lowWaterCallback;
+
+    /// A part of the gather list, either a message node or a range of
+    /// writeBuffer if node is nullptr
+    struct WriteRange
+    {
+        WriteRange(WriteNode *node, size_t offset): node(node),
+                offset(offset), size(0) {}
+        WriteNode *node;
+        size_t offset;
+        size_t size;
+    };
+
+    std::vector<char> writeBuffer; ///< Small messages being written
+    std::vector<WriteNode*> writeBufferNodes; ///< Large messages being written
+    std::vector<WriteRange> writeRanges; ///< Used by collectWrites()
+    /// Gather list being written
+    std::vector<boost::asio::const_buffer> writeBuffers;
+
+    std::vector<std::vector<char>> readBuffers; ///< Rotating read buffers
+    std::atomic<size_t> readBufferMin; ///< Configured read buffer size
+    std::atomic<size_t> readBufferMax; ///< Adaptive mode max size, or 0
+    std::atomic<size_t> readSize; ///< Current read buffer size
+    unsigned int fullReads; ///< Consecutive reads that filled readBuffer
+    unsigned int sparseReads; ///< Consecutive reads that barely used it
+    unsigned int readBufferCount; ///< Number of read buffers
+    bool consumerThread; ///< True to call the read callback in readThread
+    std::thread readThread; ///< Consumer thread
+    size_t readIndex; ///< Index of the buffer being read into
+
+    /// Used in consumer thread mode, protected by readMutex
+    std::vector<size_t> freeReadBuffers; ///< Buffers available for reading
+    /// Buffers waiting for the consumer thread, with the bytes read
+    std::deque<std::pair<size_t,size_t>> filledReadBuffers;
+    bool readStalled; ///< True if reading waits for a free buffer
+    /// Keeps the io_service running while reading is stalled
+    std::unique_ptr<boost::asio::io_service::work> readWork;
+    bool readStopping; ///< True while closing, no more reads to restart
+    std::mutex readMutex;
+    std::condition_variable readCondition;
+
+    /// Read complete callback
+    std::function<void (const char*, size_t)> callback;
+    /// Read complete callback with the arrival information, if set it is
+    /// called instead of callback
+    std::function<void (const char*, size_t, const AsyncSerial::ReadInfo&)>
+            timedCallback;
+    bool realtimeStamps; ///< If true, the wall clock time is taken too
+    /// Arrival information of the data in the read buffer of same index
+    std::vector<AsyncSerial::ReadInfo> readInfos;
+    uint64_t readSequence; ///< Chunks read since the port was opened
+    uint64_t readOffset; ///< Bytes read since the port was opened
+    unsigned int baudRate; ///< Baud rate applied by the last open()
+
+    AsyncSerial::Backend backend; ///< Backend used from the next open()
+    AsyncSerial::Backend active; ///< Backend in use
+    /// Busy polling time, duration::max() to never sleep
+    std::chrono::steady_clock::duration busyPoll;
+    /// CPUs the threads of the port can run on, empty for any
+    std::vector<unsigned int> threadCpus;
+    AsyncSerial::SchedulingPolicy threadPolicy; ///< Policy of the threads
+    int threadPriority; ///< Real time priority of the threads
+    size_t stackLock; ///< Bytes of stack the threads lock, 0 for none
+    /// Thread options that could not be applied, protected by errorMutex
+    std::string threadError;
+
+    /// Statistics, see AsyncSerial::Stats
+    StatCounter bytesReceived, chunksReceived, bytesSent, chunksSent;
+    StatCounter readSizes[AsyncSerial::Stats::histogramSize];
+    StatCounter callbackTimes[AsyncSerial::Stats::histogramSize];
+    std::atomic<size_t> writeQueuePeak;
+    std::atomic<uint64_t> errors; ///< Times error went from false to true
+    std::atomic<uint64_t> opens; ///< Times the port was opened
+    AsyncSerial::Stats statsBase; ///< Statistics at the last resetStats()
+    std::mutex statsMutex; ///< Protects statsBase
+    #ifdef ASYNCSERIAL_NATIVE_BACKENDS
+    int fd; ///< Serial port, with the epoll backend
+    int epollFd; ///< Epoll instance, created at first use
+    int wakeFd; ///< Eventfd used to wake the epoll thread
+    std::atomic<unsigned int> loopRequests; ///< Pending requests to the loop
+    bool readPaused; ///< True if all read buffers are waiting for consumer
+    std::mutex writeStateMutex; ///< See WriteStateLock
+    std::atomic<std::thread::id> writeStateOwner; ///< Holder of the mutex
+    /// Protected by writeStateMutex
+    bool loopRunning; ///< False if writes must be left queued
+    bool writeArmed; ///< True if waiting for EPOLLOUT
+    std::vector<iovec> writeIovs; ///< Gather list being written
+    size_t writeIovIndex; ///< First entry of writeIovs not fully written
+    #ifdef HAVE_IO_URING
+    std::unique_ptr<Uring> ring; ///< With the io_uring backend
+    bool fixedBuffers; ///< True if readBuffers are registered with ring
+    #endif //HAVE_IO_URING
+    #endif //ASYNCSERIAL_NATIVE_BACKENDS
+};
+
+#endif //__APPLE__
+
+#endif //ASYNCSERIALIMPL_H
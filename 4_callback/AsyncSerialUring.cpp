@@ -0,0 +1,237 @@
+/*
+ * File:   AsyncSerialUring.cpp
+ * Author: Terraneo Federico
+ * Distributed under the Boost Software License, Version 1.0.
+ *
+ * The io_uring backend of AsyncSerial, Linux only. Without io_uring support
+ * in the kernel headers setupUring() fails, and ports fall back to the
+ * epoll backend.
+ */
+
+#include "AsyncSerial.h"
+
+#ifdef ASYNCSERIAL_NATIVE_BACKENDS
+
+#include "AsyncSerialImpl.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace boost;
+
+//
+//Class AsyncSerialImpl
+//
+
+bool AsyncSerialImpl::setupUring()
+{
+    #ifdef HAVE_IO_URING
+    ring.reset(new Uring(8));
+    if(ring->valid()==false)
+    {
+        ring.reset();
+        return false;
+    }
+    //Registered buffers can't be reallocated, so they are allocated at
+    //the largest size and reads use part of them. Registering fails if
+    //over RLIMIT_MEMLOCK, then reads don't use registered buffers
+    size_t capacity=max(readBufferMin.load(),readBufferMax.load());
+    vector<iovec> iovs;
+    for(std::vector<char>& buffer : readBuffers)
+    {
+        if(buffer.size()!=capacity) vector<char>(capacity).swap(buffer);
+        iovec v;
+        v.iov_base=buffer.data();
+        v.iov_len=buffer.size();
+        iovs.push_back(v);
+    }
+    fixedBuffers=ring->registerBuffers(iovs.data(),iovs.size());
+    //Reads and writes wait in the kernel, instead of failing with
+    //EAGAIN on older kernels. Done last, so that if setup fails the port
+    //is left nonblocking for the epoll backend. closeFd() restores it
+    int flags=fcntl(fd,F_GETFL);
+    if(flags>=0) fcntl(fd,F_SETFL,flags & ~O_NONBLOCK);
+    return true;
+    #else //HAVE_IO_URING
+    return false;
+    #endif //HAVE_IO_URING
+}
+
+//
+//Class AsyncSerial
+//
+
+void AsyncSerial::runUring()
+{
+    #ifdef HAVE_IO_URING
+    currentIo=&pimpl->io; //So that write() knows it can't block
+    Uring& ring=*pimpl->ring;
+    //Operations in progress, identified by their user_data
+    enum { ReadOp=1, WriteOp=2, WakeOp=3, CancelOp=4 };
+    bool reading=false, writing=false, waking=false, ok=true;
+    size_t readLength=0;
+    //A completed read whose callback is called after the completion walk
+    bool completedRead=false;
+    size_t completedIndex=0;
+    int completedLength=0;
+    const chrono::steady_clock::duration spin=pimpl->busyPoll;
+    const bool busy=spin!=chrono::steady_clock::duration::zero();
+    chrono::steady_clock::time_point spinUntil;
+    if(busy) spinUntil=spinDeadline(spin);
+    auto queueRead=[&]()
+    {
+        std::vector<char>& buffer=pimpl->readBuffers[pimpl->readIndex];
+        readLength=min(pimpl->nextReadSize(),buffer.size());
+        io_uring_sqe *sqe=ring.getSqe();
+        sqe->opcode=pimpl->fixedBuffers ? IORING_OP_READ_FIXED :
+                IORING_OP_READ;
+        sqe->fd=pimpl->fd;
+        sqe->addr=reinterpret_cast<uint64_t>(buffer.data());
+        sqe->len=readLength;
+        sqe->buf_index=pimpl->readIndex;
+        sqe->off=-1; //Not seekable, use the current position
+        sqe->user_data=ReadOp;
+        reading=true;
+    };
+    for(;;)
+    {
+        unsigned int requests=pimpl->loopRequests.exchange(0);
+        if(requests & AsyncSerialImpl::StopRequest) break;
+        if(requests & AsyncSerialImpl::ReadRequest) pimpl->readPaused=false;
+        if(requests & AsyncSerialImpl::CheckRequest)
+        {
+            AsyncSerialImpl::WriteStateLock l(pimpl.get());
+            checkWriteQueue();
+        }
+
+        //One read is always pending, like with asio, as concurrent reads
+        //could complete out of order
+        if(waking==false)
+        {
+            io_uring_sqe *sqe=ring.getSqe();
+            sqe->opcode=IORING_OP_POLL_ADD;
+            sqe->fd=pimpl->wakeFd;
+            sqe->poll_events=POLLIN;
+            sqe->user_data=WakeOp;
+            waking=true;
+        }
+        if(reading==false && pimpl->readPaused==false) queueRead();
+        if(writing==false)
+        {
+            AsyncSerialImpl::WriteStateLock l(pimpl.get());
+            if(pimpl->prepareWrites())
+            {
+                //All queued messages go out with a single gather write
+                io_uring_sqe *sqe=ring.getSqe();
+                sqe->opcode=IORING_OP_WRITEV;
+                sqe->fd=pimpl->fd;
+                sqe->addr=reinterpret_cast<uint64_t>(
+                        &pimpl->writeIovs[pimpl->writeIovIndex]);
+                sqe->len=pimpl->writeIovCount();
+                sqe->off=-1;
+                sqe->user_data=WriteOp;
+                writing=true;
+            }
+        }
+
+        //Submitting and waiting is a single system call. When busy polling,
+        //completions are only collected until none arrives for the busy
+        //polling time
+        bool polling=busy && pimpl->readPaused==false &&
+                chrono::steady_clock::now()<spinUntil;
+        if(ring.submitAndWait(polling ? 0 : 1)==false)
+        {
+            ok=false;
+            break;
+        }
+        ring.forEachCompletion([&](uint64_t op, int result){
+            if(busy) spinUntil=spinDeadline(spin);
+            switch(op)
+            {
+                case WakeOp:
+                {
+                    waking=false;
+                    uint64_t count;
+                    if(::read(pimpl->wakeFd,&count,sizeof(count))<0) {}
+                    break;
+                }
+                case ReadOp:
+                {
+                    reading=false;
+                    if(result==-EINTR || result==-EAGAIN) break;
+                    if(result<=0)
+                    {
+                        ok=false; //As asio, end of file is an error
+                        break;
+                    }
+                    pimpl->readCompleted(result,readLength);
+                    if(pimpl->consumerThread)
+                    {
+                        //Until the consumer thread gives one back
+                        if(pimpl->queueReadBuffer(result)==false)
+                            pimpl->readPaused=true;
+                        break;
+                    }
+                    //As in readEnd(), the next read is queued now and
+                    //submitted before calling the callback, as long as
+                    //there is another buffer. The ring is not entered while
+                    //walking its completions
+                    completedRead=true;
+                    completedIndex=pimpl->readIndex;
+                    completedLength=result;
+                    pimpl->readIndex=(completedIndex+1) %
+                            pimpl->readBuffers.size();
+                    if(pimpl->readIndex!=completedIndex) queueRead();
+                    break;
+                }
+                case WriteOp:
+                {
+                    writing=false;
+                    if(result==-EINTR || result==-EAGAIN) break;
+                    AsyncSerialImpl::WriteStateLock l(pimpl.get());
+                    if(result<0)
+                    {
+                        pimpl->abortWrites();
+                        ok=false;
+                    } else pimpl->advanceWrites(result);
+                    break;
+                }
+            }
+        });
+        if(completedRead)
+        {
+            completedRead=false;
+            if(reading && ring.submitAndWait(0)==false) ok=false;
+            pimpl->readCallback(completedIndex,completedLength);
+        }
+        if(ok==false) break;
+    }
+    if(ok==false && isOpen()) setErrorStatus(true);
+
+    //The kernel may still use the buffers, wait for the operations to end
+    for(int op : {ReadOp, WriteOp, WakeOp})
+    {
+        if((op==ReadOp && !reading) || (op==WriteOp && !writing) ||
+           (op==WakeOp && !waking)) continue;
+        io_uring_sqe *sqe=ring.getSqe();
+        sqe->opcode=IORING_OP_ASYNC_CANCEL;
+        sqe->addr=op;
+        sqe->user_data=CancelOp;
+    }
+    while(reading || writing || waking)
+    {
+        if(ring.submitAndWait(1)==false) break;
+        ring.forEachCompletion([&](uint64_t op, int){
+            if(op==ReadOp) reading=false;
+            else if(op==WriteOp) writing=false;
+            else if(op==WakeOp) waking=false;
+        });
+    }
+    #endif //HAVE_IO_URING
+    AsyncSerialImpl::WriteStateLock l(pimpl.get());
+    pimpl->loopRunning=false;
+}
+
+#endif //ASYNCSERIAL_NATIVE_BACKENDS
@@ -0,0 +1,123 @@
+/*
+ * File:   Uring.cpp
+ * Author: Terraneo Federico
+ * Distributed under the Boost Software License, Version 1.0.
+ */
+
+#include "Uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+Uring::Uring(unsigned int entries): fd(-1), sqRing(MAP_FAILED),
+        cqRing(MAP_FAILED), sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+        toSubmit(0)
+{
+    io_uring_params p;
+    memset(&p,0,sizeof(p));
+    #ifdef IORING_SETUP_COOP_TASKRUN
+    //Only one thread uses the ring, it needs no interrupts to run
+    //completions as it is waiting for them anyway
+    p.flags=IORING_SETUP_COOP_TASKRUN;
+    #endif //IORING_SETUP_COOP_TASKRUN
+    fd=syscall(__NR_io_uring_setup,entries,&p);
+    if(fd<0 && errno==EINVAL)
+    {
+        memset(&p,0,sizeof(p)); //Older kernel
+        fd=syscall(__NR_io_uring_setup,entries,&p);
+    }
+    if(fd<0) return;
+    sqSize=p.sq_off.array+p.sq_entries*sizeof(unsigned int);
+    cqSize=p.cq_off.cqes+p.cq_entries*sizeof(io_uring_cqe);
+    bool single=p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) sqSize=cqSize=max(sqSize,cqSize);
+    sqRing=mmap(nullptr,sqSize,PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+    if(single) cqRing=sqRing;
+    else cqRing=mmap(nullptr,cqSize,PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_CQ_RING);
+    sqes=static_cast<io_uring_sqe*>(mmap(nullptr,
+            p.sq_entries*sizeof(io_uring_sqe),PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_SQES));
+    sqeCount=p.sq_entries;
+    if(sqRing==MAP_FAILED || cqRing==MAP_FAILED || sqes==MAP_FAILED)
+    {
+        unmap();
+        ::close(fd);
+        fd=-1;
+        return;
+    }
+    char *sq=static_cast<char*>(sqRing);
+    char *cq=static_cast<char*>(cqRing);
+    sqHead=reinterpret_cast<unsigned int*>(sq+p.sq_off.head);
+    sqTail=reinterpret_cast<unsigned int*>(sq+p.sq_off.tail);
+    sqMask=*reinterpret_cast<unsigned int*>(sq+p.sq_off.ring_mask);
+    sqArray=reinterpret_cast<unsigned int*>(sq+p.sq_off.array);
+    cqHead=reinterpret_cast<unsigned int*>(cq+p.cq_off.head);
+    cqTail=reinterpret_cast<unsigned int*>(cq+p.cq_off.tail);
+    cqMask=*reinterpret_cast<unsigned int*>(cq+p.cq_off.ring_mask);
+    cqes=reinterpret_cast<io_uring_cqe*>(cq+p.cq_off.cqes);
+}
+
+bool Uring::registerBuffers(const iovec *buffers, unsigned int count)
+{
+    return syscall(__NR_io_uring_register,fd,IORING_REGISTER_BUFFERS,
+            buffers,count)==0;
+}
+
+io_uring_sqe *Uring::getSqe()
+{
+    unsigned int tail=*sqTail+toSubmit;
+    if(tail-__atomic_load_n(sqHead,__ATOMIC_ACQUIRE)>=sqeCount)
+    {
+        submitAndWait(0); //Full, make room
+        tail=*sqTail+toSubmit;
+    }
+    unsigned int index=tail & sqMask;
+    sqArray[index]=index;
+    toSubmit++;
+    io_uring_sqe *sqe=&sqes[index];
+    memset(sqe,0,sizeof(io_uring_sqe));
+    return sqe;
+}
+
+bool Uring::submitAndWait(unsigned int count)
+{
+    __atomic_store_n(sqTail,*sqTail+toSubmit,__ATOMIC_RELEASE);
+    toSubmit=0;
+    for(;;)
+    {
+        //Also resubmits entries left over by a previous call
+        unsigned int submit=*sqTail-__atomic_load_n(sqHead,__ATOMIC_ACQUIRE);
+        //Even with count 0, GETEVENTS collects the completions that
+        //are pending, as with COOP_TASKRUN they are posted lazily
+        int result=syscall(__NR_io_uring_enter,fd,submit,count,
+                IORING_ENTER_GETEVENTS,nullptr,0);
+        if(result>=0) return true;
+        if(errno!=EINTR) return false;
+    }
+}
+
+Uring::~Uring()
+{
+    if(fd<0) return;
+    unmap();
+    ::close(fd);
+}
+
+void Uring::unmap()
+{
+    if(sqes!=MAP_FAILED) munmap(sqes,sqeCount*sizeof(io_uring_sqe));
+    if(cqRing!=MAP_FAILED && cqRing!=sqRing) munmap(cqRing,cqSize);
+    if(sqRing!=MAP_FAILED) munmap(sqRing,sqSize);
+}
+
+#endif //HAVE_IO_URING
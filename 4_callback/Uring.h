@@ -0,0 +1,100 @@
+/*
+ * File:   Uring.h
+ * Author: Terraneo Federico
+ * Distributed under the Boost Software License, Version 1.0.
+ *
+ * Minimal io_uring wrapper used by the io_uring backend of AsyncSerial.
+ * Linux only, HAVE_IO_URING is defined if the kernel headers support it.
+ */
+
+#ifndef URING_H
+#define	URING_H
+
+#ifdef __linux__
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+#endif //__linux__
+
+#ifdef HAVE_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+#include <boost/utility.hpp>
+
+/**
+ * Minimal io_uring wrapper, using the system calls directly as liburing may
+ * not be installed. Not thread safe, used by the io_uring backend thread
+ */
+class Uring: private boost::noncopyable
+{
+public:
+    /**
+     * Constructor, check valid() to know if it succeeded
+     * \param entries submission queue size
+     */
+    explicit Uring(unsigned int entries);
+
+    /**
+     * \return true if the ring has been set up
+     */
+    bool valid() const { return fd>=0; }
+
+    /**
+     * Register buffers for IORING_OP_READ_FIXED
+     * \return false on error, for example if over RLIMIT_MEMLOCK
+     */
+    bool registerBuffers(const iovec *buffers, unsigned int count);
+
+    /**
+     * \return a cleared submission queue entry, to be filled by the caller.
+     * Submitted by the next call to submitAndWait()
+     */
+    io_uring_sqe *getSqe();
+
+    /**
+     * Submit the queued entries and wait for completions, with a single
+     * system call
+     * \param count number of completions to wait for
+     * \return false on error
+     */
+    bool submitAndWait(unsigned int count);
+
+    /**
+     * Consume the completions, calling f(user_data,res) for each
+     */
+    template<typename F>
+    void forEachCompletion(F f)
+    {
+        unsigned int head=*cqHead;
+        while(head!=__atomic_load_n(cqTail,__ATOMIC_ACQUIRE))
+        {
+            io_uring_cqe cqe=cqes[head & cqMask];
+            __atomic_store_n(cqHead,++head,__ATOMIC_RELEASE);
+            f(cqe.user_data,cqe.res);
+        }
+    }
+
+    ~Uring();
+
+private:
+    void unmap();
+
+    int fd; ///< Ring file descriptor
+    void *sqRing, *cqRing; ///< Mapped rings, may be the same mapping
+    size_t sqSize, cqSize; ///< Size of the mappings
+    io_uring_sqe *sqes; ///< Submission queue entries
+    unsigned int sqeCount; ///< Number of submission queue entries
+    unsigned int *sqHead, *sqTail, sqMask, *sqArray;
+    unsigned int *cqHead, *cqTail, cqMask;
+    io_uring_cqe *cqes; ///< Completion queue entries
+    unsigned int toSubmit; ///< Entries filled but not yet submitted
+};
+
+#endif //HAVE_IO_URING
+
+#endif //URING_H
@@ -63,6 +63,11 @@ bool QAsyncSerial::errorStatus()
     return pimpl->serial.errorStatus();
 }
 
+unsigned int QAsyncSerial::getBaudRate()
+{
+    return pimpl->serial.getBaudRate();
+}
+
 void QAsyncSerial::write(QString data)
 {
     pimpl->serial.writeString(data.toStdString());
@@ -55,6 +55,14 @@ public:
      */
     bool errorStatus();
 
+    /**
+     * On Linux and Mac OS X open() accepts any integer baud rate, not just
+     * the standard ones, as long as the driver supports it
+     * \return the baud rate applied by the last open(), as reported by the
+     * driver, that may have rounded it to what the hardware can generate
+     */
+    unsigned int getBaudRate();
+
     /**
      * Write a string to the serial port
      */
@@ -2,6 +2,8 @@
  * Author: Terraneo Federico
  * Distributed under the Boost Software License, Version 1.0.
  *
+ * v1.02: Any integer baud rate on Linux, added getBaudrate()
+ *
  * v1.01:  Fixed a bug regarding reading after a timeout.
  *
  * v1.00: First release.
@@ -13,6 +15,10 @@
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
+#ifdef __linux__
+#include "termios2.h"
+#endif //__linux__
+
 using namespace std;
 using namespace boost;
 using namespace boost::asio;
@@ -52,12 +58,13 @@ public:
     streamsize bytesTransferred; ///< Used by async read callback
     char *readBuffer; ///< Used to hold read data
     streamsize readBufferSize; ///< Size of read data buffer
+    unsigned int baudrate; ///< Baud rate applied by the driver
 };
 
 SerialDeviceImpl::SerialDeviceImpl(const SerialOptions& options)
         : io(), port(io), timer(io), timeout(options.getTimeout()),
         result(resultError), bytesTransferred(0), readBuffer(0),
-        readBufferSize(0)
+        readBufferSize(0), baudrate(0)
 {
     try {
         //For this code to work, there should always be a timeout, so the
@@ -66,8 +73,6 @@ SerialDeviceImpl::SerialDeviceImpl(const SerialOptions& options)
 
         port.open(options.getDevice());//Port must be open before setting option
 
-        port.set_option(serial_port_base::baud_rate(options.getBaudrate()));
-
         switch(options.getParity())
         {
             case SerialOptions::odd:
@@ -117,6 +122,18 @@ SerialDeviceImpl::SerialDeviceImpl(const SerialOptions& options)
                         serial_port_base::stop_bits::one));
                 break;
         }
+
+        //Last, as asio only knows the baud rates having a B* constant
+        #ifdef HAVE_TERMIOS2
+        boost::system::error_code ec;
+        baudrate=setBaudRate(port.native_handle(),options.getBaudrate(),ec);
+        if(ec) throw(boost::system::system_error(ec,"Can't set baud rate"));
+        #else //HAVE_TERMIOS2
+        port.set_option(serial_port_base::baud_rate(options.getBaudrate()));
+        serial_port_base::baud_rate applied;
+        port.get_option(applied);
+        baudrate=applied.value();
+        #endif //HAVE_TERMIOS2
     } catch(std::exception& e)
     {
         throw ios::failure(e.what());
@@ -130,6 +147,11 @@ SerialDeviceImpl::SerialDeviceImpl(const SerialOptions& options)
 SerialDevice::SerialDevice(const SerialOptions& options)
                 : pImpl(new SerialDeviceImpl(options)) {}
 
+unsigned int SerialDevice::getBaudrate() const
+{
+    return pImpl->baudrate;
+}
+
 streamsize SerialDevice::read(char *s, streamsize n)
 {
     pImpl->result=resultInProgress;
@@ -50,7 +50,8 @@ public:
     /**
      * Constructor.
      * \param device device name (/dev/ttyS0, /dev/ttyUSB0, COM1, ...)
-     * \param baudrate baudrate, like 9600, 115200 ...
+     * \param baudrate baudrate, like 9600, 115200 ... On Linux any integer
+     * value, as long as the driver supports it
      * \param timeout timeout when reading, use zero to disable
      * \param parity parity
      * \param csize character size (5,6,7 or 8)
@@ -165,6 +166,15 @@ public:
      */
     std::streamsize write(const char *s, std::streamsize n);
 
+    /**
+     * On Linux any integer baud rate can be set in SerialOptions, not just
+     * the standard ones, as long as the driver supports it.
+     * Reachable from a SerialStream as serial->getBaudrate()
+     * \return the baud rate applied by the driver, that may have rounded
+     * it to what the hardware can generate
+     */
+    unsigned int getBaudrate() const;
+
 private:
     /**
      * Callack called either when the read timeout is expired or canceled.
@@ -0,0 +1,152 @@
+/*
+ * File:   PseudoTerminal.h
+ * Author: Terraneo Federico
+ * Distributed under the Boost Software License, Version 1.0.
+ *
+ * A pseudo terminal in raw mode, that the tests and benchmarks of the
+ * examples open in place of a serial port. Linux only, as it uses openpty().
+ */
+
+#ifndef PSEUDOTERMINAL_H
+#define	PSEUDOTERMINAL_H
+
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <cerrno>
+#include <pty.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <boost/utility.hpp>
+
+/**
+ * The port under test opens the slave side by name(), the test plays the
+ * device on the master side
+ */
+class PseudoTerminal: private boost::noncopyable
+{
+public:
+    /**
+     * Constructor, opens the pseudo terminal and sets it in raw mode
+     * \throws std::runtime_error on failure
+     */
+    PseudoTerminal(): masterFd(-1), slaveFd(-1)
+    {
+        char path[128];
+        if(openpty(&masterFd,&slaveFd,path,nullptr,nullptr)<0)
+            throw std::runtime_error("openpty failed");
+        devname=path;
+        termios t;
+        if(tcgetattr(slaveFd,&t)<0)
+        {
+            closeMaster();
+            closeSlave();
+            throw std::runtime_error("tcgetattr failed");
+        }
+        cfmakeraw(&t);
+        tcsetattr(slaveFd,TCSANOW,&t);
+    }
+
+    /**
+     * \return the device name of the slave side, to open the port with
+     */
+    const std::string& name() const { return devname; }
+
+    /**
+     * \return the file descriptor of the master side
+     */
+    int master() const { return masterFd; }
+
+    /**
+     * \return the file descriptor of the slave side, kept open so that the
+     * settings of the pseudo terminal persist while the port is closed
+     */
+    int slave() const { return slaveFd; }
+
+    /**
+     * Write all of data to the master side
+     * \return false on error
+     */
+    bool write(const std::string& data)
+    {
+        for(size_t sent=0;sent<data.size();)
+        {
+            ssize_t n=::write(masterFd,data.data()+sent,data.size()-sent);
+            if(n<0 && errno==EINTR) continue;
+            if(n<0 && errno==EAGAIN) { waitFor(POLLOUT,-1); continue; }
+            if(n<=0) return false;
+            sent+=n;
+        }
+        return true;
+    }
+
+    /**
+     * Read from the master side until size bytes arrived or the timeout
+     * expired
+     * \return the data read, shorter than size on timeout or error
+     */
+    std::string read(size_t size, std::chrono::milliseconds timeout)
+    {
+        std::string result;
+        auto deadline=std::chrono::steady_clock::now()+timeout;
+        while(result.size()<size)
+        {
+            auto left=std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline-std::chrono::steady_clock::now());
+            if(left.count()<0 || waitFor(POLLIN,left.count())==false) break;
+            char buffer[4096];
+            ssize_t n=::read(masterFd,buffer,
+                    std::min(sizeof(buffer),size-result.size()));
+            if(n<0 && (errno==EINTR || errno==EAGAIN)) continue;
+            if(n<=0) break;
+            result.append(buffer,n);
+        }
+        return result;
+    }
+
+    /**
+     * Close the master side, which hangs up the port
+     */
+    void closeMaster()
+    {
+        if(masterFd>=0) ::close(masterFd);
+        masterFd=-1;
+    }
+
+    /**
+     * Close the slave side
+     */
+    void closeSlave()
+    {
+        if(slaveFd>=0) ::close(slaveFd);
+        slaveFd=-1;
+    }
+
+    ~PseudoTerminal()
+    {
+        closeMaster();
+        closeSlave();
+    }
+
+private:
+    /**
+     * Wait until the master side is ready for events
+     * \return false on timeout or error
+     */
+    bool waitFor(short events, int timeoutMs)
+    {
+        pollfd p;
+        p.fd=masterFd;
+        p.events=events;
+        p.revents=0;
+        return poll(&p,1,timeoutMs)>0 && (p.revents & events);
+    }
+
+    int masterFd; ///< Master side, written and read by the test
+    int slaveFd; ///< Slave side, opened by name by the port under test
+    std::string devname; ///< Device name of the slave side
+};
+
+#endif //PSEUDOTERMINAL_H
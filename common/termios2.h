@@ -0,0 +1,81 @@
+/*
+ * File:   termios2.h
+ * Author: Terraneo Federico
+ * Distributed under the Boost Software License, Version 1.0.
+ *
+ * Any integer baud rate on Linux, through the termios2 ioctls. Shared by the
+ * serial port classes of the examples, that include it on Linux only and
+ * use setBaudRate() if HAVE_TERMIOS2 is defined.
+ */
+
+#ifndef TERMIOS2_H
+#define	TERMIOS2_H
+
+#include <cerrno>
+#include <cstring>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <boost/asio/serial_port_base.hpp>
+
+#ifdef TCGETS2
+#define HAVE_TERMIOS2
+
+/**
+ * The kernel's struct termios2, as asm/termbits.h can't be included together
+ * with termios.h. TCGETS2 and TCSETS2 encode its size, so on an architecture
+ * with a different layout they fail with ENOTTY instead of corrupting memory
+ */
+struct termios2
+{
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+
+/**
+ * Set the baud rate with termios2, that unlike tcsetattr() and asio accepts
+ * any integer baud rate, not just the ones having a B* constant.
+ * Input and output baud rate are set to the same value
+ * \param fd serial port
+ * \param baud baud rate, for both directions
+ * \param ec set on failure
+ * \return the baud rate applied by the driver, that may have rounded it to
+ * what the hardware can generate
+ */
+inline unsigned int setBaudRate(int fd, unsigned int baud,
+        boost::system::error_code& ec)
+{
+    struct termios2 tio;
+    if(ioctl(fd,TCGETS2,&tio)==0)
+    {
+        //Standard baud rates keep their B* constant, so that code using
+        //tcgetattr(), including asio, still understands the settings
+        termios ios;
+        std::memset(&ios,0,sizeof(ios));
+        boost::asio::serial_port_base::baud_rate(baud).store(ios,ec);
+        tio.c_cflag&=~(CBAUD | CIBAUD);
+        tio.c_cflag|= ec ? BOTHER : (ios.c_cflag & CBAUD);
+        tio.c_ispeed=baud;
+        tio.c_ospeed=baud;
+        if(ioctl(fd,TCSETS2,&tio)==0 && ioctl(fd,TCGETS2,&tio)==0)
+        {
+            ec=boost::system::error_code();
+            return tio.c_ospeed;
+        }
+    }
+    ec.assign(errno,boost::system::system_category());
+    return 0;
+}
+
+#endif //TCGETS2
+
+#endif //TERMIOS2_H